@@ -1,81 +1,286 @@
 #include "BitStream.hh"
 
 #include <algorithm>
-#include <iostream>
 #include <cassert>
+#include <cstring>
 
-BitStreamWriter::BitStreamWriter() {
+static uint64_t loadLittleEndian(uint8_t const* bytes) {
+    uint64_t word;
+    memcpy(&word, bytes, sizeof(word));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    return word;
 }
 
-void BitStreamWriter::writeBytes(uint8_t const* data, size_t size) {
-    assert(data != nullptr);
-    assert(size > 0);
+static void storeLittleEndian(uint8_t* bytes, uint64_t word) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    memcpy(bytes, &word, sizeof(word));
+}
 
-    auto oldSize = buffer.size();
-    buffer.resize(oldSize + size);
-    std::copy(data, data + size, &buffer[oldSize]);
+BitStreamWriter::BitStreamWriter()
+    : data(nullptr), capacity(0), counting(false), owning(true), bitIndex(0) {
 }
 
-uint8_t const* BitStreamWriter::ptr() const {
-    assert(buffer.size() > 0);
+BitStreamWriter::BitStreamWriter(uint8_t* buffer, size_t capacity)
+    : data(buffer), capacity(capacity), counting(false), owning(false),
+      bitIndex(0) {
+    assert(buffer != nullptr || capacity == 0);
+}
+
+BitStreamWriter BitStreamWriter::counter() {
+    BitStreamWriter writer;
+    writer.counting = true;
+    writer.owning = false;
+    return writer;
+}
+
+uint8_t* BitStreamWriter::reserve(size_t index) {
+    if (owning) {
+        if (index >= buffer.size())
+            buffer.resize(std::max<size_t>(64, std::max(index + 1, buffer.size() * 2)));
+
+        return &buffer[0];
+    }
+
+    assert(index < capacity); // a fixed buffer must be large enough
+    return data;
+}
+
+void BitStreamWriter::storeBits(uint64_t value, unsigned numBits) {
+    assert(numBits <= 64);
+    assert(numBits == 64 || value < (uint64_t(1) << numBits));
+
+    if (numBits == 0)
+        return;
+
+    size_t byteIndex = bitIndex / 8;
+    unsigned offset = bitIndex % 8;
+
+    // Fast path: the bits fit into one shifted 64-bit word, and there is
+    // room to store the whole word. Bits after the written ones become zero,
+    // which is what later writes expect.
+    if (offset + numBits <= 64 && (owning || byteIndex + 8 <= capacity)) {
+        uint8_t* bytes = reserve(byteIndex + 7) + byteIndex;
+
+        uint64_t word = value << offset;
+        if (offset > 0)
+            word |= bytes[0] & ((1u << offset) - 1);
+
+        storeLittleEndian(bytes, word);
+
+        bitIndex += numBits;
+        return;
+    }
 
-    return &buffer[0];
+    while (numBits > 0) {
+        unsigned offset = bitIndex % 8;
+        uint8_t* byte = reserve(bitIndex / 8) + bitIndex / 8;
+        if (offset == 0)
+            *byte = 0;
+
+        unsigned n = std::min(8 - offset, numBits);
+        uint8_t bits = static_cast<uint8_t>(value & ((1u << n) - 1));
+
+        *byte |= bits << offset;
+
+        value >>= n;
+        numBits -= n;
+        bitIndex += n;
+    }
+}
+
+void BitStreamWriter::writeBytes(uint8_t const* bytes, size_t size) {
+    assert(bytes != nullptr || size == 0);
+
+    if (counting) {
+        bitIndex += size * 8;
+        return;
+    }
+
+    if (bitIndex % 8 == 0) {
+        if (size > 0) {
+            uint8_t* target = reserve(bitIndex / 8 + size - 1);
+            std::copy(bytes, bytes + size, target + bitIndex / 8);
+        }
+        bitIndex += size * 8;
+        return;
+    }
+
+    for (size_t i = 0; i < size; i++)
+        writeBits(bytes[i], 8);
 }
 
-size_t BitStreamWriter::size() const {
-    return buffer.size();
+uint8_t const* BitStreamWriter::ptr() const {
+    assert(!counting);
+    assert(size() > 0);
+
+    return owning ? &buffer[0] : data;
 }
 
 void BitStreamWriter::reset() {
-    buffer.resize(0);
+    bitIndex = 0;
 }
 
 BitStreamReader::BitStreamReader(std::vector<uint8_t> const& v)
-    : BitStreamReader(&v[0], v.size()) {
+    : BitStreamReader(v.data(), v.size()) {
 }
 
+// Empty input is allowed, e.g. an empty packet, but fails on the first read
 BitStreamReader::BitStreamReader(uint8_t const* buffer, size_t bufferLength)
-    : buffer(buffer), bufferLength(bufferLength), index(0) {
-    assert(buffer != nullptr);
-    assert(bufferLength > 0);
+    : buffer(buffer), bufferLength(bufferLength), bitIndex(0), failed(false) {
+    assert(buffer != nullptr || bufferLength == 0);
+}
+
+uint64_t BitStreamReader::readBits(unsigned numBits) {
+    assert(numBits <= 64);
+
+    if (numBits > bitsLeft()) {
+        fail();
+        return 0;
+    }
+
+    size_t byteIndex = bitIndex / 8;
+    unsigned offset = bitIndex % 8;
+
+    // Fast path: the bits are contained in the next eight bytes,
+    // which we load as one little-endian word
+    if (offset + numBits <= 64 && byteIndex + 8 <= bufferLength) {
+        uint64_t word = loadLittleEndian(buffer + byteIndex);
+
+        bitIndex += numBits;
+
+        word >>= offset;
+        return numBits == 64 ? word : word & ((uint64_t(1) << numBits) - 1);
+    }
+
+    uint64_t value = 0;
+    unsigned shift = 0;
+
+    while (shift < numBits) {
+        offset = bitIndex % 8;
+        unsigned n = std::min(8 - offset, numBits - shift);
+
+        uint64_t bits = (buffer[bitIndex / 8] >> offset) & ((1u << n) - 1);
+        value |= bits << shift;
+
+        shift += n;
+        bitIndex += n;
+    }
+
+    return value;
 }
 
 void BitStreamReader::readBytes(uint8_t* out, size_t size) {
     assert(out != nullptr);
-    assert(size > 0);
-    assert(index + size <= bufferLength);
 
-    std::copy(buffer + index, buffer + index + size, out);
-    index += size;
+    if (size * 8 > bitsLeft()) {
+        fail();
+        std::fill(out, out + size, 0);
+        return;
+    }
+
+    if (bitIndex % 8 == 0) {
+        std::copy(buffer + bitIndex / 8, buffer + bitIndex / 8 + size, out);
+        bitIndex += size * 8;
+        return;
+    }
+
+    for (size_t i = 0; i < size; i++)
+        out[i] = static_cast<uint8_t>(readBits(8));
 }
 
 bool BitStreamReader::eof() {
-    return index == bufferLength;
+    return position() == bufferLength;
 }
 
 std::vector<uint8_t> BitStreamReader::restVector() const {
-    return std::vector<uint8_t>(buffer + index, buffer + bufferLength);
+    return std::vector<uint8_t>(buffer + position(), buffer + bufferLength);
 }
 
 void BitStreamReader::skip(size_t offset) {
-    assert(index + offset <= bufferLength);
-    index += offset;
+    if (offset > bufferLength - position()) {
+        fail();
+        return;
+    }
+
+    bitIndex = (position() + offset) * 8;
+}
+
+void BitStreamReader::fail() {
+    failed = true;
+    bitIndex = bufferLength * 8;
+}
+
+void writeRanged(BitStreamWriter& stream, uint64_t value, uint64_t maxValue) {
+    assert(value <= maxValue);
+    stream.writeBits(value, bitsForRange(maxValue));
+}
+
+uint64_t readRanged(BitStreamReader& stream, uint64_t maxValue) {
+    uint64_t value = stream.readBits(bitsForRange(maxValue));
+    if (value > maxValue) {
+        stream.fail();
+        return 0;
+    }
+    return value;
+}
+
+void writeVarint(BitStreamWriter& stream, uint64_t value) {
+    do {
+        uint64_t group = value & 0x7f;
+        value >>= 7;
+
+        stream.writeBits(group | (value != 0 ? 0x80 : 0), 8);
+    } while (value != 0);
+}
+
+uint64_t readVarint(BitStreamReader& stream) {
+    uint64_t value = 0;
+
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        uint64_t group = stream.readBits(8);
+        value |= (group & 0x7f) << shift;
+
+        if (!(group & 0x80))
+            return value;
+    }
+
+    stream.fail(); // more than 64 bits
+    return 0;
+}
+
+size_t readLength(BitStreamReader& stream, unsigned minBits) {
+    assert(minBits > 0);
+
+    uint64_t length = readVarint(stream);
+    if (length > stream.bitsLeft() / minBits) {
+        stream.fail();
+        return 0;
+    }
+    return static_cast<size_t>(length);
+}
+
+void write(BitStreamWriter& stream, bool value) {
+    stream.writeBits(value ? 1 : 0, 1);
+}
+
+void read(BitStreamReader& stream, bool& value) {
+    value = stream.readBits(1) != 0;
 }
 
 void write(BitStreamWriter& stream, std::string const& str) {
-    write(stream, str.size());
+    writeVarint(stream, str.size());
     stream.writeBytes(
-            reinterpret_cast<const uint8_t*>(str.c_str()),
+            reinterpret_cast<const uint8_t*>(str.data()),
             str.size());
 }
 
 void read(BitStreamReader& stream, std::string& str) {
-    size_t size;
-    read(stream, size);
-    str = std::string(size, ' ');
-    
-    // This might just explode on you.
-    stream.readBytes(
-            reinterpret_cast<uint8_t*>(const_cast<char*>(str.c_str())),
-            size);
+    str.resize(readLength(stream, 8));
+
+    for (auto& c : str)
+        c = static_cast<char>(stream.readBits(8));
 }
@@ -1,84 +1,198 @@
 #ifndef STRAT_COMMON_BITSTREAM_HH
 #define STRAT_COMMON_BITSTREAM_HH
 
+#include "SmallVector.hh"
+
 #include <cstdint>
 #include <vector>
 #include <string>
 #include <type_traits>
-#include <iostream>
-#include <typeinfo>
-
-// These bit streams operate on a byte level... for now. :P
-// Doesn't take care of endianness issues.
 
+// Bit-granular streams for serialization.
+//
+// Values are packed LSB first: the first bit written ends up in the lowest
+// bit of the first byte. Integers are thereby stored in little-endian order,
+// independent of the platform. The last byte is padded with zero bits.
+//
+// Only integers can be written directly. Other types need their own
+// read/write overloads, which decide how to pack their fields, e.g. with
+// writeVarint for lengths and ids or writeRanged for small enums.
+
+// A writer either owns a growing buffer, writes into memory supplied by the
+// caller (e.g. the data of an ENet packet), or only counts the bits that
+// would be written. Counting first allows allocating the target memory
+// with the exact size and then serializing into it without any copies.
 struct BitStreamWriter {
     BitStreamWriter();
 
+    // Writes into `buffer', which must be large enough for everything
+    BitStreamWriter(uint8_t* buffer, size_t capacity);
+
+    // Returns a writer that only counts the size of what is written
+    static BitStreamWriter counter();
+
+    // Writes the lowest `numBits' bits of `value' (at most 64)
+    void writeBits(uint64_t value, unsigned numBits) {
+        if (counting)
+            bitIndex += numBits;
+        else
+            storeBits(value, numBits);
+    }
+
     void writeBytes(uint8_t const* data, size_t size);
 
     uint8_t const* ptr() const;
-    size_t size() const;
 
+    // Size in bytes, including the padding of the last byte
+    size_t size() const { return (bitIndex + 7) / 8; }
+    size_t bitSize() const { return bitIndex; }
+
+    // Starts writing at the beginning again, keeping the memory
     void reset();
 
 private:
-    std::vector<uint8_t> buffer;
+    std::vector<uint8_t> buffer; // only used if we own the memory
+
+    uint8_t* data; // only used for memory supplied by the caller
+    size_t capacity;
+    bool counting;
+    bool owning;
+
+    size_t bitIndex;
+
+    void storeBits(uint64_t value, unsigned numBits);
+
+    // Makes sure that the byte at `index' is available,
+    // returns the start of the memory
+    uint8_t* reserve(size_t index);
 };
 
+// Readers are fed untrusted data from the network, so malformed input must
+// not bring the process down. Reading past the end, or a value that the
+// format does not allow, marks the reader as failed instead; from then on
+// it only returns zeros. Callers check hasFailed() once they are done and
+// throw away whatever they read.
 struct BitStreamReader {
     BitStreamReader(std::vector<uint8_t> const&);
     BitStreamReader(uint8_t const* buffer, size_t bufferLength);
 
+    uint64_t readBits(unsigned numBits);
+
     void readBytes(uint8_t* out, size_t size);
 
+    // True if only the padding of the last byte is left
     bool eof();
 
-    size_t position() const { return index; }
+    // Position in bytes, rounded up
+    size_t position() const { return (bitIndex + 7) / 8; }
+
+    size_t bitsLeft() const { return bufferLength * 8 - bitIndex; }
 
     std::vector<uint8_t> restVector() const;
 
+    // Skips `offset' bytes, starting at the next byte boundary
     void skip(size_t offset);
 
+    // Marks the input as malformed and stops reading
+    void fail();
+
+    bool hasFailed() const { return failed; }
+
 private:
     uint8_t const* buffer;
     size_t const bufferLength;
 
-    size_t index;
+    size_t bitIndex;
+    bool failed;
 };
 
-template<typename T/*,
-         typename = typename std::enable_if<std::is_pod<T>::value>::type*/>
+// Number of bits needed to store values in [0, maxValue]
+inline unsigned bitsForRange(uint64_t maxValue) {
+    unsigned bits = 0;
+    while (maxValue > 0) {
+        bits++;
+        maxValue >>= 1;
+    }
+    return bits;
+}
+
+// Value in [0, maxValue], using as few bits as possible
+void writeRanged(BitStreamWriter&, uint64_t value, uint64_t maxValue);
+uint64_t readRanged(BitStreamReader&, uint64_t maxValue);
+
+// Unsigned integer in groups of seven bits, each followed by a continuation
+// bit. Small values, such as lengths and ids, take one byte.
+void writeVarint(BitStreamWriter&, uint64_t value);
+uint64_t readVarint(BitStreamReader&);
+
+// Varint length of a sequence whose elements take at least `minBits' each.
+// Lengths that the rest of the stream can not hold fail the reader and read
+// as zero, before anyone allocates for them.
+size_t readLength(BitStreamReader&, unsigned minBits);
+
+template<typename T>
 void write(BitStreamWriter& stream, const T& value) {
-    stream.writeBytes(reinterpret_cast<uint8_t const*>(&value), sizeof(T));
+    static_assert(std::is_integral<T>::value,
+                  "No serialization defined for this type");
+
+    typedef typename std::make_unsigned<T>::type U;
+    stream.writeBits(static_cast<U>(value), sizeof(T) * 8);
 }
 
+void write(BitStreamWriter&, bool);
 void write(BitStreamWriter&, std::string const&);
 
 template<typename T>
 void write(BitStreamWriter& stream, const std::vector<T>& v) {
-    write(stream, v.size());
+    writeVarint(stream, v.size());
 
     for (auto& e : v)
         write(stream, e);
 }
 
-template<typename T/*,
-         typename = typename std::enable_if<std::is_pod<T>::value>::type*/>
+template<typename T, size_t N>
+void write(BitStreamWriter& stream, const SmallVector<T, N>& v) {
+    writeVarint(stream, v.size());
+
+    for (auto& e : v)
+        write(stream, e);
+}
+
+template<typename T>
 void read(BitStreamReader& stream, T& value) {
-    stream.readBytes(reinterpret_cast<uint8_t*>(&value), sizeof(T));
+    static_assert(std::is_integral<T>::value,
+                  "No serialization defined for this type");
+
+    typedef typename std::make_unsigned<T>::type U;
+    value = static_cast<T>(static_cast<U>(stream.readBits(sizeof(T) * 8)));
 }
 
+void read(BitStreamReader&, bool&);
 void read(BitStreamReader&, std::string&);
 
 template<typename T>
 void read(BitStreamReader& stream, std::vector<T>& v) {
-    size_t size;
-    read(stream, size);
+    v.resize(readLength(stream, 1));
+
+    for (auto& e : v)
+        read(stream, e);
+}
 
-    v.resize(size);
+template<typename T, size_t N>
+void read(BitStreamReader& stream, SmallVector<T, N>& v) {
+    v.resize(readLength(stream, 1));
 
     for (auto& e : v)
         read(stream, e);
 }
 
+// Exact number of bytes that writing `value' produces, e.g. for allocating
+// a packet before serializing into it
+template<typename T>
+size_t encodedSize(const T& value) {
+    BitStreamWriter counter(BitStreamWriter::counter());
+    write(counter, value);
+    return counter.size();
+}
+
 #endif
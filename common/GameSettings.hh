@@ -2,13 +2,11 @@
 #define STRAT_COMMON_GAME_SETTINGS_HH
 
 #include "Defs.hh"
+#include "Schema.hh"
 
 #include <vector>
 #include <string>
 
-struct BitStreamReader;
-struct BitStreamWriter;
-
 struct PlayerInfo {
     PlayerId id;
     std::string name;
@@ -16,8 +14,15 @@ struct PlayerInfo {
     uint8_t color;
 };
 
+typedef Schema<
+    SCHEMA_FIELD(PlayerInfo, id, Varint),
+    SCHEMA_FIELD(PlayerInfo, name, String),
+    SCHEMA_FIELD(PlayerInfo, team, Varint),
+    SCHEMA_FIELD(PlayerInfo, color, Fixed<uint8_t>)
+> PlayerInfoSchema;
+
 void read(BitStreamReader &, PlayerInfo &);
-void write(BitStreamWriter &, PlayerInfo &);
+void write(BitStreamWriter &, const PlayerInfo &);
 
 struct GameSettings {
     std::vector<PlayerInfo> players;
@@ -25,8 +30,21 @@ struct GameSettings {
     uint32_t mapW, mapH; 
     uint32_t heightLimit;
     uint32_t tickLengthMs;
+
+    // Number of ships every player starts with
+    uint32_t fleetSize;
 };
 
+typedef Schema<
+    SCHEMA_FIELD(GameSettings, players, List<Struct<PlayerInfoSchema>>),
+    SCHEMA_FIELD(GameSettings, randomSeed, Fixed<uint32_t>),
+    SCHEMA_FIELD(GameSettings, mapW, Varint),
+    SCHEMA_FIELD(GameSettings, mapH, Varint),
+    SCHEMA_FIELD(GameSettings, heightLimit, Varint),
+    SCHEMA_FIELD(GameSettings, tickLengthMs, Varint),
+    SCHEMA_FIELD(GameSettings, fleetSize, Varint)
+> GameSettingsSchema;
+
 void read(BitStreamReader &, GameSettings &);
 void write(BitStreamWriter &, const GameSettings &);
 
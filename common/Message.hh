@@ -3,66 +3,202 @@
 
 #include "Order.hh"
 #include "GameSettings.hh"
+#include "Schema.hh"
+#include "SmallVector.hh"
 
 #include <enet/enet.h>
 
 #include <vector>
 #include <string>
 
-struct BitStreamReader;
-struct BitStreamWriter;
+// ENet channels
+enum {
+    CHANNEL_CONTROL, // reliable, everything except ticks
+    CHANNEL_TICKS,   // unsequenced, for SERVER_TICK
+    CHANNEL_BULK,    // reliable, snapshots and ticks for rejoining clients
 
+    NUM_CHANNELS
+};
+
+// The server runs at most this many ticks ahead of the slowest client
+const size_t MAX_CLIENT_LAG = 8;
+
+// Orders of one tick. Most ticks carry none or just a few.
+typedef SmallVector<Order, 4> TickOrders;
+
+// A message holds the fields of every type, only those of its own type are
+// used. The lists are SmallVectors, so that decoding the frequent messages
+// does not allocate memory, and messages can be copied, e.g. into a queue.
+// Only the rare ones (connecting, starting, snapshots) use the heap.
 struct Message {
     enum Type {
         UNDEFINED,
 
         // Messages sent by client
         CLIENT_CONNECT,
-        CLIENT_ORDER,
+        CLIENT_ORDERS,
         CLIENT_TICK_DONE,
+        CLIENT_SNAPSHOT,
+        CLIENT_SNAPSHOT_FAILED,
 
         // Messages sent by server
         SERVER_CONNECT,
         SERVER_TICK,
         SERVER_START,
+        SERVER_SNAPSHOT_REQUEST,
+        SERVER_SNAPSHOT,
     };
 
     Type type;
 
-    Message(Type);
-    ~Message();
+    explicit Message(Type = UNDEFINED);
 
+    // To take over a player in a running match, e.g. after losing the
+    // connection, matchId and playerId identify the player, and
+    // rejoinToken proves that it is ours. Zero joins a new match.
+    //
+    // A relay joins with the names of the clients behind it and takes a
+    // seat for each of them at once. The server answers with one
+    // SERVER_CONNECT per seat, in the same order.
     struct ClientConnect {
         std::string name;
+        uint32_t matchId;
+        PlayerId playerId;
+        uint64_t rejoinToken;
+        std::vector<std::string> relayedNames;
     };
 
+    // All orders a client issued since its last message
+    struct ClientOrders {
+        SmallVector<Order, 8> orders;
+    };
+
+    // Ticks are sent unreliably. To cover lost packets without waiting
+    // for a retransmission, every message repeats the orders of the
+    // previous ticks that some client might not have received yet.
     struct ServerTick {
-        std::vector<Order> orders;
+        // Number of the newest tick in the message
+        uint32_t tick;
+
+        // Orders of the ticks (tick - ticks.size(), tick], oldest first.
+        // A resend after a lost message covers MAX_CLIENT_LAG + 1 ticks.
+        SmallVector<TickOrders, MAX_CLIENT_LAG + 1> ticks;
+
+        // Clients should request their orders for this many ticks
+        // after the last tick they have executed
+        uint32_t inputDelay;
+
+        // For each order of the newest tick, the microseconds between the
+        // server receiving it and starting the tick, so that clients can
+        // trace the latency of their orders
+        SmallVector<uint32_t, 4> holdUs;
     };
 
     struct ServerStart {
         GameSettings settings;
     };
 
-    union {
-        ClientConnect client_connect;
+    // Simulation state for a client that rejoins a running match. The
+    // server asks one of the other clients for its state, which is
+    // compressed and split into chunks that the server forwards as they
+    // arrive (see common/Snapshot.hh). A client that can not load the
+    // snapshot answers with CLIENT_SNAPSHOT_FAILED, and the server asks
+    // another client for one.
+    struct SnapshotChunk {
+        uint32_t tick;           // the state is the one after this tick
+        uint32_t size;           // of the uncompressed state
+        uint32_t compressedSize; // total size of all chunks
+        uint32_t offset;         // of this chunk in the compressed data
+        std::vector<uint8_t> data;
+    };
+
+    // The token is a random secret per player, needed to rejoin
+    struct ServerConnect {
+        PlayerId yourPlayerId;
+        uint32_t matchId;
+        uint64_t rejoinToken;
+    };
 
-        struct {
-            Order order;
-        } client_order;
+    ClientConnect client_connect;
+    ClientOrders client_orders;
 
-        struct {
-            PlayerId yourPlayerId;
-        } server_connect;
+    ServerConnect server_connect;
+    ServerStart server_start;
+    ServerTick server_tick;
 
-        ServerStart server_start;
-        ServerTick server_tick;
-    };
+    // CLIENT_SNAPSHOT and SERVER_SNAPSHOT
+    SnapshotChunk snapshot_chunk;
 
-    ENetPacket *toPacket() const;
+    ENetPacket *toPacket(enet_uint32 flags = ENET_PACKET_FLAG_RELIABLE) const;
 };
 
-// NOTE: Assumes message type has already been read
+typedef Schema<
+    SCHEMA_FIELD(Message::ClientConnect, name, String),
+    SCHEMA_FIELD(Message::ClientConnect, matchId, Varint),
+    SCHEMA_FIELD(Message::ClientConnect, playerId, Varint),
+    SCHEMA_FIELD(Message::ClientConnect, rejoinToken, Fixed<uint64_t>),
+    SCHEMA_FIELD(Message::ClientConnect, relayedNames, List<String>)
+> ClientConnectSchema;
+
+typedef Schema<
+    SCHEMA_FIELD(Message::ClientOrders, orders, List<Struct<OrderSchema>>)
+> ClientOrdersSchema;
+
+typedef Schema<
+    SCHEMA_FIELD(Message::ServerConnect, yourPlayerId, Varint),
+    SCHEMA_FIELD(Message::ServerConnect, matchId, Varint),
+    SCHEMA_FIELD(Message::ServerConnect, rejoinToken, Fixed<uint64_t>)
+> ServerConnectSchema;
+
+typedef Schema<
+    SCHEMA_FIELD(Message::ServerTick, tick, Varint),
+    SCHEMA_FIELD(Message::ServerTick, ticks, List<List<Struct<OrderSchema>>>),
+    SCHEMA_FIELD(Message::ServerTick, inputDelay, Ranged<MAX_CLIENT_LAG>),
+    SCHEMA_FIELD(Message::ServerTick, holdUs, List<Varint>)
+> ServerTickSchema;
+
+typedef Schema<
+    SCHEMA_FIELD(Message::ServerStart, settings, Struct<GameSettingsSchema>)
+> ServerStartSchema;
+
+typedef Schema<
+    SCHEMA_FIELD(Message::SnapshotChunk, tick, Varint),
+    SCHEMA_FIELD(Message::SnapshotChunk, size, Varint),
+    SCHEMA_FIELD(Message::SnapshotChunk, compressedSize, Varint),
+    SCHEMA_FIELD(Message::SnapshotChunk, offset, Varint),
+    SCHEMA_FIELD(Message::SnapshotChunk, data, Bytes)
+> SnapshotChunkSchema;
+
+// A new message type needs a Case here
+typedef Schema<
+    Variant<
+        SCHEMA_FIELD(Message, type, Ranged<Message::SERVER_SNAPSHOT>),
+        Case<Message::CLIENT_CONNECT,
+             SCHEMA_FIELD(Message, client_connect, Struct<ClientConnectSchema>)>,
+        Case<Message::CLIENT_ORDERS,
+             SCHEMA_FIELD(Message, client_orders, Struct<ClientOrdersSchema>)>,
+        Case<Message::CLIENT_TICK_DONE>,
+        Case<Message::CLIENT_SNAPSHOT,
+             SCHEMA_FIELD(Message, snapshot_chunk, Struct<SnapshotChunkSchema>)>,
+        Case<Message::CLIENT_SNAPSHOT_FAILED>,
+        Case<Message::SERVER_CONNECT,
+             SCHEMA_FIELD(Message, server_connect, Struct<ServerConnectSchema>)>,
+        Case<Message::SERVER_TICK,
+             SCHEMA_FIELD(Message, server_tick, Struct<ServerTickSchema>)>,
+        Case<Message::SERVER_START,
+             SCHEMA_FIELD(Message, server_start, Struct<ServerStartSchema>)>,
+        Case<Message::SERVER_SNAPSHOT_REQUEST>,
+        Case<Message::SERVER_SNAPSHOT,
+             SCHEMA_FIELD(Message, snapshot_chunk, Struct<SnapshotChunkSchema>)>
+    >
+> MessageSchema;
+
+// Clients pass this as the data of their ENet connect, so that the server
+// can turn away builds whose messages it would not understand
+const enet_uint32 PROTOCOL_FINGERPRINT = static_cast<enet_uint32>(
+    MessageSchema::fingerprint() ^ (MessageSchema::fingerprint() >> 32));
+
+// Reads the type, followed by the fields of that type
 void read(BitStreamReader &, Message &);
 
 void write(BitStreamWriter &, const Message &);
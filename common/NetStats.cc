@@ -0,0 +1,207 @@
+#include "NetStats.hh"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+
+static const char *const MESSAGE_TYPE_NAMES[] = {
+    "UNDEFINED",
+    "CLIENT_CONNECT",
+    "CLIENT_ORDERS",
+    "CLIENT_TICK_DONE",
+    "CLIENT_SNAPSHOT",
+    "CLIENT_SNAPSHOT_FAILED",
+    "SERVER_CONNECT",
+    "SERVER_TICK",
+    "SERVER_START",
+    "SERVER_SNAPSHOT_REQUEST",
+    "SERVER_SNAPSHOT"
+};
+
+static_assert(sizeof(MESSAGE_TYPE_NAMES) / sizeof(MESSAGE_TYPE_NAMES[0]) ==
+              NUM_MESSAGE_TYPES, "every message type needs a name");
+
+Histogram::Histogram()
+    : count(0),
+      sum(0),
+      max(0) {
+    std::fill(buckets, buckets + NUM_BUCKETS, 0);
+}
+
+// 1, 2, 3, 4, 6, 8, 12, 16, ...; the last bucket is unbounded
+double Histogram::bucketBound(size_t i) {
+    assert(i < NUM_BUCKETS);
+
+    if (i == NUM_BUCKETS - 1)
+        return INFINITY;
+    if (i == 0)
+        return 1;
+    if (i % 2 == 1)
+        return std::ldexp(1.0, static_cast<int>(i + 1) / 2);
+    return 1.5 * std::ldexp(1.0, static_cast<int>(i) / 2);
+}
+
+void Histogram::add(double value) {
+    value = std::max(value, 0.0);
+
+    size_t i = 0;
+    while (value >= bucketBound(i))
+        i++;
+
+    buckets[i]++;
+    count++;
+    sum += value;
+    max = std::max(max, value);
+}
+
+double Histogram::percentile(double p) const {
+    if (count == 0)
+        return 0;
+
+    uint64_t rank = static_cast<uint64_t>(std::ceil(p * count));
+    rank = std::max<uint64_t>(rank, 1);
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < NUM_BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen >= rank)
+            return std::min(bucketBound(i), max);
+    }
+
+    return max;
+}
+
+std::ostream &operator<<(std::ostream &os, const Histogram &histogram) {
+    return os << "p50 " << histogram.percentile(0.5)
+              << ", p99 " << histogram.percentile(0.99)
+              << ", max " << histogram.max;
+}
+
+// Buckets are listed up to the last non-empty one, see
+// Histogram::bucketBound() for their bounds
+void writeJson(std::ostream &os, const Histogram &histogram) {
+    os << "{\"count\":" << histogram.count
+       << ",\"mean\":" << histogram.mean()
+       << ",\"p50\":" << histogram.percentile(0.5)
+       << ",\"p90\":" << histogram.percentile(0.9)
+       << ",\"p99\":" << histogram.percentile(0.99)
+       << ",\"max\":" << histogram.max
+       << ",\"buckets\":[";
+
+    size_t end = Histogram::NUM_BUCKETS;
+    while (end > 0 && histogram.buckets[end - 1] == 0)
+        end--;
+
+    for (size_t i = 0; i < end; i++)
+        os << (i > 0 ? "," : "") << histogram.buckets[i];
+
+    os << "]}";
+}
+
+Traffic::Traffic() {
+    std::fill(packets, packets + NUM_MESSAGE_TYPES, 0);
+    std::fill(bytes, bytes + NUM_MESSAGE_TYPES, 0);
+}
+
+void Traffic::add(Message::Type type, size_t size) {
+    assert(type < NUM_MESSAGE_TYPES);
+
+    packets[type]++;
+    bytes[type] += size;
+}
+
+uint64_t Traffic::totalPackets() const {
+    uint64_t total = 0;
+    for (size_t i = 0; i < NUM_MESSAGE_TYPES; i++)
+        total += packets[i];
+    return total;
+}
+
+uint64_t Traffic::totalBytes() const {
+    uint64_t total = 0;
+    for (size_t i = 0; i < NUM_MESSAGE_TYPES; i++)
+        total += bytes[i];
+    return total;
+}
+
+// Only the message types that occurred are listed
+void writeJson(std::ostream &os, const Traffic &traffic) {
+    os << "{";
+
+    bool first = true;
+    for (size_t i = 0; i < NUM_MESSAGE_TYPES; i++) {
+        if (traffic.packets[i] == 0)
+            continue;
+
+        os << (first ? "" : ",")
+           << "\"" << MESSAGE_TYPE_NAMES[i] << "\":{\"packets\":"
+           << traffic.packets[i] << ",\"bytes\":" << traffic.bytes[i] << "}";
+        first = false;
+    }
+
+    os << "}";
+}
+
+PeerStats::PeerStats()
+    : heldBackMs(0),
+      droppedOrders(0),
+      mergedOrders(0),
+      clampedOrders(0) {
+}
+
+void PeerStats::sampleRtt(const ENetPeer *peer) {
+    rttMs.add(peer->roundTripTime);
+    jitterMs.add(peer->roundTripTimeVariance);
+}
+
+std::ostream &operator<<(std::ostream &os, const PeerStats &stats) {
+    return os << "RTT " << stats.rttMs << "ms, "
+              << "jitter " << stats.jitterMs << "ms; "
+              << "sent " << stats.sent.totalPackets() << " packets, "
+              << stats.sent.totalBytes() << " bytes; "
+              << "received " << stats.received.totalPackets() << " packets, "
+              << stats.received.totalBytes() << " bytes; "
+              << "tick lag " << stats.tickLag << "; "
+              << "tick lead " << stats.tickLead << "; "
+              << "held back " << stats.heldBackMs << "ms; "
+              << stats.droppedOrders << " orders dropped, "
+              << stats.mergedOrders << " merged, "
+              << stats.clampedOrders << " clamped";
+}
+
+void writeJson(std::ostream &os, const PeerStats &stats) {
+    os << "{\"rttMs\":";
+    writeJson(os, stats.rttMs);
+    os << ",\"jitterMs\":";
+    writeJson(os, stats.jitterMs);
+    os << ",\"tickLag\":";
+    writeJson(os, stats.tickLag);
+    os << ",\"tickLead\":";
+    writeJson(os, stats.tickLead);
+    os << ",\"heldBackMs\":" << stats.heldBackMs;
+    os << ",\"droppedOrders\":" << stats.droppedOrders;
+    os << ",\"mergedOrders\":" << stats.mergedOrders;
+    os << ",\"clampedOrders\":" << stats.clampedOrders;
+    os << ",\"sent\":";
+    writeJson(os, stats.sent);
+    os << ",\"received\":";
+    writeJson(os, stats.received);
+    os << "}";
+}
+
+uint64_t wallTimeMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+StatsFile::StatsFile(const std::string &filename)
+    : file(filename.c_str(), std::ios::out | std::ios::app) {
+}
+
+void StatsFile::write(const std::string &line) {
+    assert(line.find('\n') == std::string::npos);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    file << line << std::endl;
+}
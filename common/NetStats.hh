@@ -0,0 +1,122 @@
+#ifndef STRAT_COMMON_NET_STATS_HH
+#define STRAT_COMMON_NET_STATS_HH
+
+#include "Message.hh"
+
+#include <enet/enet.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+// Telemetry of the network path, kept by the server for every client and
+// by the client for its connection to the server. Both sides print a
+// summary line regularly and can additionally append their stats as one
+// JSON object per line to a file, for looking at them with other tools.
+
+const size_t NUM_MESSAGE_TYPES = Message::SERVER_SNAPSHOT + 1;
+
+// Distribution of non-negative values in buckets that grow exponentially,
+// with two buckets per power of two. Percentiles are rounded up to the
+// bound of their bucket, but never exceed the maximum.
+struct Histogram {
+    static const size_t NUM_BUCKETS = 24;
+
+    uint64_t buckets[NUM_BUCKETS];
+    uint64_t count;
+    double sum;
+    double max;
+
+    Histogram();
+
+    void add(double value);
+
+    double mean() const { return count > 0 ? sum / count : 0.0; }
+    double percentile(double p) const;
+
+    // Upper bound of bucket i, exclusive
+    static double bucketBound(size_t i);
+};
+
+std::ostream &operator<<(std::ostream &, const Histogram &);
+void writeJson(std::ostream &, const Histogram &);
+
+// Packets and bytes of one direction, by message type
+struct Traffic {
+    uint64_t packets[NUM_MESSAGE_TYPES];
+    uint64_t bytes[NUM_MESSAGE_TYPES];
+
+    Traffic();
+
+    void add(Message::Type, size_t bytes);
+
+    uint64_t totalPackets() const;
+    uint64_t totalBytes() const;
+};
+
+void writeJson(std::ostream &, const Traffic &);
+
+// Counters of one connection since the last reset
+struct PeerStats {
+    Traffic sent;
+    Traffic received;
+
+    // Round trip time and its variance as estimated by ENet,
+    // sampled once per tick
+    Histogram rttMs;
+    Histogram jitterMs;
+
+    // How many ticks the client is behind the newest tick of the server:
+    // sampled by the server when it starts a tick, and by the client when
+    // a tick message arrives
+    Histogram tickLag;
+
+    // How many ticks data arrives before it is needed: on the server, the
+    // orders before their tick is started (zero if late), on the client,
+    // the ticks waiting in the jitter buffer when one is started
+    Histogram tickLead;
+
+    // Server only: how long the match waited for this client's
+    // CLIENT_TICK_DONE while the next tick was due
+    double heldBackMs;
+
+    // Server only: orders beyond the client's budget for their tick or
+    // the limits of a single order (see MAX_UNIT_RANGES), and orders that
+    // were executed, but cut down to those limits (see MAX_MERGED_COUNT)
+    uint64_t droppedOrders;
+    uint64_t mergedOrders;
+    uint64_t clampedOrders;
+
+    PeerStats();
+
+    void sampleRtt(const ENetPeer *);
+};
+
+std::ostream &operator<<(std::ostream &, const PeerStats &);
+void writeJson(std::ostream &, const PeerStats &);
+
+// Milliseconds since the epoch, for the records of StatsFile
+uint64_t wallTimeMs();
+
+// Appends lines of JSON to a file. Shared by the threads of the server,
+// so writes are serialized.
+struct StatsFile {
+    explicit StatsFile(const std::string &filename);
+
+    StatsFile(const StatsFile &) = delete;
+    StatsFile &operator=(const StatsFile &) = delete;
+
+    bool isOpen() const { return file.is_open(); }
+
+    // `line' must not contain newlines
+    void write(const std::string &line);
+
+private:
+    std::mutex mutex;
+    std::ofstream file;
+};
+
+#endif
@@ -1,33 +1,98 @@
 #include "Order.hh"
 
-#include "BitStream.hh"
-
 #include <cassert>
 
-void read(BitStreamReader &reader, Order &order) {
-    read(reader, order.player);
-    read(reader, order.type);
+size_t UnitSet::size() const {
+    size_t result = 0;
+    for (auto &range : ranges)
+        result += range.count;
+    return result;
+}
 
-    switch (order.type) {
-        case Order::UNDEFINED:
-            assert(false);
-            return;
-        case Order::ACCELERATE:
-            read(reader, order.accelerate.direction);
-            return;
+void UnitSet::add(uint32_t index) {
+    addRange(index, 1);
+}
+
+void UnitSet::addRange(uint32_t first, uint32_t count) {
+    assert(count > 0);
+    assert(ranges.empty() ||
+           first >= ranges.back().first + ranges.back().count);
+
+    if (!ranges.empty() && ranges.back().first + ranges.back().count == first) {
+        ranges.back().count += count;
+    } else {
+        UnitRange range;
+        range.first = first;
+        range.count = count;
+        ranges.push_back(range);
     }
 }
 
-void write(BitStreamWriter &writer, const Order &order) {
-    write(writer, order.player);
-    write(writer, order.type);
+bool UnitSet::isValid(size_t numUnits) const {
+    // Computed in 64 bits, so that no sum overflows
+    uint64_t end = 0;
 
-    switch (order.type) {
-        case Order::UNDEFINED:
-            assert(false);
+    for (auto &range : ranges) {
+        if (range.count == 0 || range.first < end)
+            return false;
+
+        end = static_cast<uint64_t>(range.first) + range.count;
+        if (end > numUnits)
+            return false;
+    }
+
+    return true;
+}
+
+bool UnitSet::operator==(const UnitSet &other) const {
+    if (ranges.size() != other.ranges.size())
+        return false;
+
+    for (size_t i = 0; i < ranges.size(); i++) {
+        if (ranges[i].first != other.ranges[i].first ||
+            ranges[i].count != other.ranges[i].count)
+            return false;
+    }
+
+    return true;
+}
+
+bool Order::canMerge(const Order &other) const {
+    if (type != other.type || player != other.player || tick != other.tick ||
+        units != other.units)
+        return false;
+
+    switch (type) {
+        case ACCELERATE:
+            return accelerate.direction == other.accelerate.direction &&
+                   accelerate.count + other.accelerate.count <= MAX_MERGED_COUNT;
+
+        default:
+            return false;
+    }
+}
+
+void Order::merge(const Order &other) {
+    assert(canMerge(other));
+
+    // The merged order stands for the latest of the orders
+    seq = other.seq;
+
+    switch (type) {
+        case ACCELERATE:
+            accelerate.count += other.accelerate.count;
             return;
-        case Order::ACCELERATE:
-            write(writer, order.accelerate.direction);
+
+        default:
+            assert(false);
             return;
     }
 }
+
+void read(BitStreamReader &reader, Order &order) {
+    OrderSchema::read(reader, order);
+}
+
+void write(BitStreamWriter &writer, const Order &order) {
+    OrderSchema::write(writer, order);
+}
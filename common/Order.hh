@@ -2,9 +2,8 @@
 #define STRAT_COMMON_ORDER_HH
 
 #include "Defs.hh"
-
-struct BitStreamReader;
-struct BitStreamWriter;
+#include "Schema.hh"
+#include "SmallVector.hh"
 
 enum Direction {
     DIRECTION_LEFT,
@@ -13,6 +12,42 @@ enum Direction {
     DIRECTION_BACKWARD
 };
 
+// Units are addressed by their index among the units of their player,
+// in the order in which they were created. Selections tend to be
+// contiguous, so sets of units are stored as ranges of indices.
+struct UnitRange {
+    uint32_t first;
+    uint32_t count;
+};
+
+// The units an order applies to. The ranges are sorted and do not
+// overlap. An empty set stands for the player's first unit.
+struct UnitSet {
+    SmallVector<UnitRange, 1> ranges;
+
+    bool empty() const { return ranges.empty(); }
+
+    // Number of units in the set
+    size_t size() const;
+
+    // Adds a unit behind all the ones in the set
+    void add(uint32_t index);
+
+    // Adds the units [first, first + count) behind all the ones in the set
+    void addRange(uint32_t first, uint32_t count);
+
+    // Whether the ranges are well-formed and all indices are below numUnits
+    bool isValid(size_t numUnits) const;
+
+    bool operator==(const UnitSet &other) const;
+    bool operator!=(const UnitSet &other) const { return !(*this == other); }
+};
+
+// What a single order may carry. Merging keeps counts within the limit,
+// and the server clamps or drops orders from clients beyond either one.
+const uint16_t MAX_MERGED_COUNT = 1000;
+const size_t MAX_UNIT_RANGES = 64;
+
 struct Order {
     enum Type {
         UNDEFINED,
@@ -20,18 +55,71 @@ struct Order {
     } type;
 
     Order(Type type = UNDEFINED)
-        : type(type) {
+        : type(type), seq(0), tick(0), accelerate() {
+        if (type == ACCELERATE)
+            accelerate.count = 1;
     }
 
+    // Whether `other' can be merged into this order, i.e. executing the
+    // merged order has the same effect as executing both after each other
+    bool canMerge(const Order &other) const;
+
+    void merge(const Order &other);
+
     PlayerId player;
 
-    union {
-        struct {
-            Direction direction;
-        } accelerate;
+    // Sequence number assigned by the issuing client.
+    // The server passes it through unchanged, so that clients can tell
+    // which of their own orders have been executed.
+    uint32_t seq;
+
+    // Tick in which the order is executed. Clients request a tick,
+    // the server moves orders that arrive too late to the next tick.
+    uint32_t tick;
+
+    // An order commands all of these units at once
+    UnitSet units;
+
+    // Parameters of the individual order types. They are separate members
+    // instead of a union, so that the wire format can refer to them.
+    struct Accelerate {
+        Direction direction;
+
+        // Repeated orders in the same direction are sent as one,
+        // executing the acceleration `count' times
+        uint16_t count;
     };
+
+    Accelerate accelerate;
 };
 
+typedef Schema<
+    SCHEMA_FIELD(UnitRange, first, Varint),
+    SCHEMA_FIELD(UnitRange, count, Varint)
+> UnitRangeSchema;
+
+typedef Schema<
+    SCHEMA_FIELD(UnitSet, ranges, List<Struct<UnitRangeSchema>>)
+> UnitSetSchema;
+
+typedef Schema<
+    SCHEMA_FIELD(Order::Accelerate, direction, Ranged<DIRECTION_BACKWARD>),
+    SCHEMA_FIELD(Order::Accelerate, count, Varint)
+> AccelerateOrderSchema;
+
+// A new order type needs a Case here
+typedef Schema<
+    SCHEMA_FIELD(Order, player, Varint),
+    SCHEMA_FIELD(Order, seq, Varint),
+    SCHEMA_FIELD(Order, tick, Varint),
+    SCHEMA_FIELD(Order, units, Struct<UnitSetSchema>),
+    Variant<
+        SCHEMA_FIELD(Order, type, Ranged<Order::ACCELERATE>),
+        Case<Order::ACCELERATE,
+             SCHEMA_FIELD(Order, accelerate, Struct<AccelerateOrderSchema>)>
+    >
+> OrderSchema;
+
 void read(BitStreamReader &, Order &);
 void write(BitStreamWriter &, const Order &);
 
@@ -0,0 +1,204 @@
+#include "Replay.hh"
+
+#include "BitStream.hh"
+
+#include <cassert>
+#include <cstring>
+#include <iostream>
+
+static const char REPLAY_MAGIC[4] = { 'S', 'T', 'R', 'R' };
+static const uint32_t REPLAY_VERSION = 5;
+
+enum {
+    RECORD_TICK = 1,
+    RECORD_KEYFRAME = 2
+};
+
+// type (1 byte), tick (4 bytes), payload size (4 bytes)
+static const size_t RECORD_HEADER_SIZE = 9;
+
+ReplayWriter::ReplayWriter(const std::string &filename,
+                           const GameSettings &settings,
+                           size_t keyframeInterval)
+    : file(filename, std::ios::binary | std::ios::trunc),
+      keyframeInterval(keyframeInterval) {
+    if (!file.good()) {
+        std::cerr << "Failed to open replay file " << filename
+                  << " for writing" << std::endl;
+        return;
+    }
+
+    BitStreamWriter writer;
+    write(writer, settings);
+
+    uint32_t settingsSize = writer.size();
+
+    file.write(REPLAY_MAGIC, sizeof(REPLAY_MAGIC));
+    file.write(reinterpret_cast<const char *>(&REPLAY_VERSION), sizeof(REPLAY_VERSION));
+    file.write(reinterpret_cast<const char *>(&settingsSize), sizeof(settingsSize));
+    file.write(reinterpret_cast<const char *>(writer.ptr()), writer.size());
+}
+
+bool ReplayWriter::isOpen() const {
+    return file.good();
+}
+
+void ReplayWriter::writeTick(size_t tick, const std::vector<Order> &orders) {
+    BitStreamWriter writer;
+    write(writer, orders);
+
+    writeRecord(RECORD_TICK, tick, writer.ptr(), writer.size());
+}
+
+bool ReplayWriter::wantsKeyframe(size_t tick) const {
+    return keyframeInterval > 0 && tick % keyframeInterval == 0;
+}
+
+void ReplayWriter::writeKeyframe(size_t tick, const uint8_t *data, size_t size) {
+    writeRecord(RECORD_KEYFRAME, tick, data, size);
+
+    // Make sure that everything up to the keyframe survives a crash
+    file.flush();
+}
+
+void ReplayWriter::writeRecord(uint8_t type, size_t tick,
+                               const uint8_t *data, size_t size) {
+    if (!file.good())
+        return;
+
+    uint32_t tick32 = tick, size32 = size;
+
+    file.write(reinterpret_cast<const char *>(&type), sizeof(type));
+    file.write(reinterpret_cast<const char *>(&tick32), sizeof(tick32));
+    file.write(reinterpret_cast<const char *>(&size32), sizeof(size32));
+    file.write(reinterpret_cast<const char *>(data), size);
+}
+
+ReplayReader::ReplayReader(const std::string &filename)
+    : file(filename, std::ios::binary),
+      valid(false) {
+    if (!file.good()) {
+        std::cerr << "Failed to open replay file " << filename << std::endl;
+        return;
+    }
+
+    char magic[4];
+    uint32_t version, settingsSize;
+
+    file.read(magic, sizeof(magic));
+    file.read(reinterpret_cast<char *>(&version), sizeof(version));
+    file.read(reinterpret_cast<char *>(&settingsSize), sizeof(settingsSize));
+
+    if (!file.good() || memcmp(magic, REPLAY_MAGIC, sizeof(magic)) != 0 ||
+        version != REPLAY_VERSION || settingsSize == 0) {
+        std::cerr << filename << " is not a valid replay file" << std::endl;
+        return;
+    }
+
+    std::vector<uint8_t> settingsData(settingsSize);
+    file.read(reinterpret_cast<char *>(&settingsData[0]), settingsSize);
+    if (!file.good()) {
+        std::cerr << filename << " is truncated" << std::endl;
+        return;
+    }
+
+    BitStreamReader reader(settingsData);
+    read(reader, settings);
+    if (reader.hasFailed()) {
+        std::cerr << filename << " has malformed settings" << std::endl;
+        return;
+    }
+
+    // Build the index. A truncated last record is ignored, since the
+    // replay may have been cut off while it was being written.
+    std::streamoff offset = file.tellg();
+
+    file.seekg(0, std::ios::end);
+    std::streamoff fileSize = file.tellg();
+
+    while (offset + static_cast<std::streamoff>(RECORD_HEADER_SIZE) <= fileSize) {
+        uint8_t type;
+        uint32_t tick, size;
+
+        file.seekg(offset);
+        file.read(reinterpret_cast<char *>(&type), sizeof(type));
+        file.read(reinterpret_cast<char *>(&tick), sizeof(tick));
+        file.read(reinterpret_cast<char *>(&size), sizeof(size));
+
+        std::streamoff next = offset + RECORD_HEADER_SIZE + size;
+        if (!file.good() || next > fileSize)
+            break;
+
+        if (type == RECORD_TICK) {
+            if (tick != tickOffsets.size() + 1) {
+                std::cerr << filename << ": unexpected tick " << tick
+                          << ", stopping at tick " << tickOffsets.size()
+                          << std::endl;
+                break;
+            }
+
+            tickOffsets.push_back(offset);
+        } else if (type == RECORD_KEYFRAME) {
+            keyframeOffsets[tick] = offset;
+        }
+
+        offset = next;
+    }
+
+    file.clear();
+    valid = true;
+}
+
+bool ReplayReader::isOpen() const {
+    return valid;
+}
+
+bool ReplayReader::readTick(size_t tick, std::vector<Order> &orders) {
+    if (tick == 0 || tick > tickOffsets.size())
+        return false;
+
+    std::vector<uint8_t> data;
+    if (!readRecord(tickOffsets[tick - 1], data))
+        return false;
+
+    BitStreamReader reader(data);
+    read(reader, orders);
+
+    return !reader.hasFailed();
+}
+
+bool ReplayReader::findKeyframe(size_t tick, size_t &keyframeTick) const {
+    auto it = keyframeOffsets.upper_bound(tick);
+    if (it == keyframeOffsets.begin())
+        return false;
+
+    --it;
+    keyframeTick = it->first;
+    return true;
+}
+
+bool ReplayReader::readKeyframe(size_t keyframeTick, std::vector<uint8_t> &data) {
+    auto it = keyframeOffsets.find(keyframeTick);
+    if (it == keyframeOffsets.end())
+        return false;
+
+    return readRecord(it->second, data);
+}
+
+bool ReplayReader::readRecord(std::streamoff offset, std::vector<uint8_t> &data) {
+    file.seekg(offset + static_cast<std::streamoff>(RECORD_HEADER_SIZE) - 4);
+
+    uint32_t size;
+    file.read(reinterpret_cast<char *>(&size), sizeof(size));
+
+    data.resize(size);
+    if (size > 0)
+        file.read(reinterpret_cast<char *>(&data[0]), size);
+
+    if (!file.good()) {
+        file.clear();
+        return false;
+    }
+
+    return true;
+}
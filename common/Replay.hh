@@ -0,0 +1,78 @@
+#ifndef STRAT_COMMON_REPLAY_HH
+#define STRAT_COMMON_REPLAY_HH
+
+#include "GameSettings.hh"
+#include "Order.hh"
+
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+// Replays store a match as the GameSettings plus the orders of every tick,
+// which is enough to simulate the match again deterministically.
+//
+// The file is append-only: a header with the settings, followed by records.
+// Every record starts with its type, tick and payload length, so that
+// readers can skip over records without decoding them.
+// Additionally, replays can contain keyframes with the complete
+// simulation state (see Sim::save). Keyframes allow jumping to a tick
+// without simulating the whole match from the start.
+//
+// Tick n is the n-th tick executed, starting at 1. The keyframe for tick n
+// contains the state after tick n has been executed; the keyframe for tick 0
+// contains the initial state.
+
+struct ReplayWriter {
+    // Keyframes are requested every `keyframeInterval' ticks,
+    // zero disables keyframes.
+    ReplayWriter(const std::string &filename, const GameSettings &,
+                 size_t keyframeInterval);
+
+    bool isOpen() const;
+
+    void writeTick(size_t tick, const std::vector<Order> &);
+
+    // Whether a keyframe should be stored after executing `tick'
+    bool wantsKeyframe(size_t tick) const;
+    void writeKeyframe(size_t tick, const uint8_t *data, size_t size);
+
+private:
+    std::ofstream file;
+    size_t keyframeInterval;
+
+    void writeRecord(uint8_t type, size_t tick, const uint8_t *data, size_t size);
+};
+
+struct ReplayReader {
+    // Reads the header and builds an index of all records
+    ReplayReader(const std::string &filename);
+
+    bool isOpen() const;
+
+    const GameSettings &getSettings() const { return settings; }
+
+    // Number of ticks stored in the replay
+    size_t getNumTicks() const { return tickOffsets.size(); }
+
+    bool readTick(size_t tick, std::vector<Order> &);
+
+    // Returns the tick of the latest keyframe at or before `tick',
+    // or false if there is none
+    bool findKeyframe(size_t tick, size_t &keyframeTick) const;
+    bool readKeyframe(size_t keyframeTick, std::vector<uint8_t> &);
+
+private:
+    std::ifstream file;
+    bool valid;
+
+    GameSettings settings;
+
+    std::vector<std::streamoff> tickOffsets; // indexed by tick - 1
+    std::map<size_t, std::streamoff> keyframeOffsets;
+
+    bool readRecord(std::streamoff offset, std::vector<uint8_t> &);
+};
+
+#endif
@@ -0,0 +1,288 @@
+#ifndef STRAT_COMMON_SCHEMA_HH
+#define STRAT_COMMON_SCHEMA_HH
+
+#include "BitStream.hh"
+
+#include <cassert>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Declarative wire formats.
+//
+// A type's format is declared once as a Schema, a list of its fields in
+// wire order, each with the encoding used for it:
+//
+//     typedef Schema<
+//         SCHEMA_FIELD(PlayerInfo, id, Varint),
+//         SCHEMA_FIELD(PlayerInfo, name, String)
+//     > PlayerInfoSchema;
+//
+// The schema provides write(), read() and fingerprint(). The former two are
+// templates that the compiler expands into straight-line code, so that the
+// reader and the writer can not drift apart. Tagged unions are declared as
+// a Variant: a tag field followed by the fields of the matching Case.
+//
+// The fingerprint is a hash of the structure of the format (encodings and
+// their parameters, not the names of the fields), computed at compile time.
+// Peers compare fingerprints on connecting to notice incompatible builds.
+//
+// The exact encoded size of a value is available via encodedSize() in
+// BitStream.hh, which runs the writer without storing anything.
+
+constexpr uint64_t mixFingerprint(uint64_t a, uint64_t b) {
+    return ((a ^ b) * 0x100000001b3ULL) ^ (a >> 29);
+}
+
+// Encodings. Each one has static write(), read() and fingerprint().
+
+// Unsigned integers and enums with small values
+struct Varint {
+    template<typename T>
+    static void write(BitStreamWriter &writer, T value) {
+        writeVarint(writer, value);
+    }
+
+    template<typename T>
+    static void read(BitStreamReader &reader, T &value) {
+        value = static_cast<T>(readVarint(reader));
+    }
+
+    static constexpr uint64_t fingerprint() { return 1; }
+};
+
+// Values in [0, MAX], e.g. enums, in the minimal number of bits
+template<uint64_t MAX>
+struct Ranged {
+    template<typename T>
+    static void write(BitStreamWriter &writer, T value) {
+        writeRanged(writer, value, MAX);
+    }
+
+    template<typename T>
+    static void read(BitStreamReader &reader, T &value) {
+        value = static_cast<T>(readRanged(reader, MAX));
+    }
+
+    static constexpr uint64_t fingerprint() { return mixFingerprint(2, MAX); }
+};
+
+// Integers in their full width, e.g. hashes or seeds
+template<typename I>
+struct Fixed {
+    static void write(BitStreamWriter &writer, I value) {
+        ::write(writer, value);
+    }
+
+    static void read(BitStreamReader &reader, I &value) {
+        ::read(reader, value);
+    }
+
+    static constexpr uint64_t fingerprint() {
+        return mixFingerprint(3, sizeof(I));
+    }
+};
+
+struct String {
+    static void write(BitStreamWriter &writer, const std::string &value) {
+        ::write(writer, value);
+    }
+
+    static void read(BitStreamReader &reader, std::string &value) {
+        ::read(reader, value);
+    }
+
+    static constexpr uint64_t fingerprint() { return 4; }
+};
+
+// Opaque binary data, copied byte-wise
+struct Bytes {
+    static void write(BitStreamWriter &writer, const std::vector<uint8_t> &data) {
+        writeVarint(writer, data.size());
+        if (!data.empty())
+            writer.writeBytes(&data[0], data.size());
+    }
+
+    static void read(BitStreamReader &reader, std::vector<uint8_t> &data) {
+        data.resize(readLength(reader, 8));
+        if (!data.empty())
+            reader.readBytes(&data[0], data.size());
+    }
+
+    static constexpr uint64_t fingerprint() { return 5; }
+};
+
+// std::vector or SmallVector with elements in the encoding E
+template<typename E>
+struct List {
+    template<typename L>
+    static void write(BitStreamWriter &writer, const L &list) {
+        writeVarint(writer, list.size());
+        for (auto &element : list)
+            E::write(writer, element);
+    }
+
+    template<typename L>
+    static void read(BitStreamReader &reader, L &list) {
+        // Elements take at least a bit, except in encodings we do not use
+        list.resize(readLength(reader, 1));
+        for (auto &element : list)
+            E::read(reader, element);
+    }
+
+    static constexpr uint64_t fingerprint() {
+        return mixFingerprint(6, E::fingerprint());
+    }
+};
+
+// Nested structure with schema S
+template<typename S>
+struct Struct {
+    template<typename T>
+    static void write(BitStreamWriter &writer, const T &value) {
+        S::write(writer, value);
+    }
+
+    template<typename T>
+    static void read(BitStreamReader &reader, T &value) {
+        S::read(reader, value);
+    }
+
+    static constexpr uint64_t fingerprint() {
+        return mixFingerprint(7, S::fingerprint());
+    }
+};
+
+// Schema elements. Each one has static write() and read() for the type it
+// belongs to, and fingerprint().
+
+template<typename C, typename M, M C::*member, typename E>
+struct Field {
+    typedef M Type;
+
+    static const M &get(const C &object) { return object.*member; }
+
+    static void write(BitStreamWriter &writer, const C &object) {
+        E::write(writer, object.*member);
+    }
+
+    static void read(BitStreamReader &reader, C &object) {
+        E::read(reader, object.*member);
+    }
+
+    static constexpr uint64_t fingerprint() { return E::fingerprint(); }
+};
+
+#define SCHEMA_FIELD(Class, member, Encoding) \
+    Field<Class, decltype(Class::member), &Class::member, Encoding>
+
+template<typename... Elements>
+struct Schema;
+
+template<>
+struct Schema<> {
+    template<typename C>
+    static void write(BitStreamWriter &, const C &) {}
+
+    template<typename C>
+    static void read(BitStreamReader &, C &) {}
+
+    static constexpr uint64_t fingerprint() { return 0xcbf29ce484222325ULL; }
+};
+
+template<typename Element, typename... Rest>
+struct Schema<Element, Rest...> {
+    template<typename C>
+    static void write(BitStreamWriter &writer, const C &object) {
+        Element::write(writer, object);
+        Schema<Rest...>::write(writer, object);
+    }
+
+    template<typename C>
+    static void read(BitStreamReader &reader, C &object) {
+        Element::read(reader, object);
+        Schema<Rest...>::read(reader, object);
+    }
+
+    static constexpr uint64_t fingerprint() {
+        return mixFingerprint(Element::fingerprint(),
+                              Schema<Rest...>::fingerprint());
+    }
+};
+
+// The elements that follow the tag of a Variant if it has the value TAG
+template<uint64_t TAG, typename... Elements>
+struct Case {
+    static const uint64_t tag = TAG;
+
+    typedef Schema<Elements...> Body;
+};
+
+template<typename... Cases>
+struct CaseList;
+
+template<>
+struct CaseList<> {
+    template<typename C>
+    static void write(BitStreamWriter &, const C &, uint64_t) {
+        assert(false); // unknown tag
+    }
+
+    // Tags come from the peer, so an unknown one is malformed input
+    template<typename C>
+    static void read(BitStreamReader &reader, C &, uint64_t) {
+        reader.fail();
+    }
+
+    static constexpr uint64_t fingerprint() { return 0; }
+};
+
+template<typename First, typename... Rest>
+struct CaseList<First, Rest...> {
+    template<typename C>
+    static void write(BitStreamWriter &writer, const C &object, uint64_t tag) {
+        if (tag == First::tag)
+            First::Body::write(writer, object);
+        else
+            CaseList<Rest...>::write(writer, object, tag);
+    }
+
+    template<typename C>
+    static void read(BitStreamReader &reader, C &object, uint64_t tag) {
+        if (tag == First::tag)
+            First::Body::read(reader, object);
+        else
+            CaseList<Rest...>::read(reader, object, tag);
+    }
+
+    static constexpr uint64_t fingerprint() {
+        return mixFingerprint(
+            mixFingerprint(First::tag, First::Body::fingerprint()),
+            CaseList<Rest...>::fingerprint());
+    }
+};
+
+// A tag field, followed by the elements of the Case for its value.
+// Every valid tag value needs a Case, even if it has no elements.
+template<typename Tag, typename... Cases>
+struct Variant {
+    template<typename C>
+    static void write(BitStreamWriter &writer, const C &object) {
+        Tag::write(writer, object);
+        CaseList<Cases...>::write(writer, object, Tag::get(object));
+    }
+
+    template<typename C>
+    static void read(BitStreamReader &reader, C &object) {
+        Tag::read(reader, object);
+        CaseList<Cases...>::read(reader, object, Tag::get(object));
+    }
+
+    static constexpr uint64_t fingerprint() {
+        return mixFingerprint(Tag::fingerprint(),
+                              CaseList<Cases...>::fingerprint());
+    }
+};
+
+#endif
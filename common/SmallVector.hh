@@ -0,0 +1,144 @@
+#ifndef STRAT_COMMON_SMALL_VECTOR_HH
+#define STRAT_COMMON_SMALL_VECTOR_HH
+
+#include <cassert>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+
+// A vector that stores up to N elements inside the object itself and
+// only allocates memory on the heap when it grows beyond that.
+//
+// Used for message contents, where almost every list is short: decoding
+// them into a SmallVector does not allocate, and neither does copying.
+template<typename T, size_t N>
+struct SmallVector {
+    static_assert(N > 0, "SmallVector needs inline storage");
+
+    typedef T value_type;
+    typedef T *iterator;
+    typedef const T *const_iterator;
+
+    SmallVector()
+        : elements(inlineElements()), count(0), capacity_(N) {
+    }
+
+    template<typename Iterator>
+    SmallVector(Iterator first, Iterator last)
+        : elements(inlineElements()), count(0), capacity_(N) {
+        assign(first, last);
+    }
+
+    SmallVector(const SmallVector &other)
+        : elements(inlineElements()), count(0), capacity_(N) {
+        assign(other.begin(), other.end());
+    }
+
+    SmallVector &operator=(const SmallVector &other) {
+        if (this != &other)
+            assign(other.begin(), other.end());
+        return *this;
+    }
+
+    ~SmallVector() {
+        clear();
+        if (!isInline())
+            ::operator delete(elements);
+    }
+
+    size_t size() const { return count; }
+    size_t capacity() const { return capacity_; }
+    bool empty() const { return count == 0; }
+
+    // Whether the elements are stored in the object itself
+    bool isInline() const { return elements == inlineElements(); }
+
+    T *data() { return elements; }
+    const T *data() const { return elements; }
+
+    iterator begin() { return elements; }
+    iterator end() { return elements + count; }
+    const_iterator begin() const { return elements; }
+    const_iterator end() const { return elements + count; }
+
+    T &operator[](size_t i) { assert(i < count); return elements[i]; }
+    const T &operator[](size_t i) const { assert(i < count); return elements[i]; }
+
+    T &front() { assert(count > 0); return elements[0]; }
+    const T &front() const { assert(count > 0); return elements[0]; }
+    T &back() { assert(count > 0); return elements[count - 1]; }
+    const T &back() const { assert(count > 0); return elements[count - 1]; }
+
+    void clear() {
+        for (size_t i = 0; i < count; i++)
+            elements[i].~T();
+        count = 0;
+    }
+
+    void reserve(size_t minCapacity) {
+        if (minCapacity <= capacity_)
+            return;
+
+        T *grown = static_cast<T *>(::operator new(minCapacity * sizeof(T)));
+        for (size_t i = 0; i < count; i++) {
+            new(&grown[i]) T(elements[i]);
+            elements[i].~T();
+        }
+
+        if (!isInline())
+            ::operator delete(elements);
+
+        elements = grown;
+        capacity_ = minCapacity;
+    }
+
+    // New elements are value-initialized
+    void resize(size_t newCount) {
+        while (count > newCount)
+            elements[--count].~T();
+
+        reserve(newCount);
+        for (; count < newCount; count++)
+            new(&elements[count]) T();
+    }
+
+    void push_back(const T &value) {
+        if (count == capacity_) {
+            // `value' may be one of our own elements
+            T copy(value);
+            reserve(2 * capacity_);
+            new(&elements[count++]) T(copy);
+        } else {
+            new(&elements[count++]) T(value);
+        }
+    }
+
+    void pop_back() {
+        assert(count > 0);
+        elements[--count].~T();
+    }
+
+    // The range must not point into this vector
+    template<typename Iterator>
+    void assign(Iterator first, Iterator last) {
+        clear();
+        reserve(static_cast<size_t>(last - first));
+
+        for (; first != last; ++first)
+            new(&elements[count++]) T(*first);
+    }
+
+private:
+    T *elements;
+    size_t count;
+    size_t capacity_;
+
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage[N];
+
+    T *inlineElements() { return reinterpret_cast<T *>(storage); }
+    const T *inlineElements() const {
+        return reinterpret_cast<const T *>(storage);
+    }
+};
+
+#endif
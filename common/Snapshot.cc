@@ -0,0 +1,51 @@
+#include "Snapshot.hh"
+
+#include <enet/enet.h>
+
+#include <cassert>
+
+void compressSnapshot(const std::vector<uint8_t> &data,
+                      std::vector<uint8_t> &compressed) {
+    compressed.resize(data.size());
+    if (data.empty())
+        return;
+
+    void *rangeCoder = enet_range_coder_create();
+    assert(rangeCoder);
+
+    ENetBuffer buffer;
+    buffer.data = const_cast<uint8_t *>(&data[0]);
+    buffer.dataLength = data.size();
+
+    // Fails if the result is not smaller than the input
+    size_t size = enet_range_coder_compress(rangeCoder, &buffer, 1, data.size(),
+                                            &compressed[0], data.size() - 1);
+    enet_range_coder_destroy(rangeCoder);
+
+    if (size == 0)
+        compressed = data;
+    else
+        compressed.resize(size);
+}
+
+bool decompressSnapshot(const std::vector<uint8_t> &compressed, size_t size,
+                        std::vector<uint8_t> &data) {
+    if (compressed.size() == size) {
+        data = compressed;
+        return true;
+    }
+
+    if (compressed.empty() || compressed.size() > size)
+        return false;
+
+    data.resize(size);
+
+    void *rangeCoder = enet_range_coder_create();
+    assert(rangeCoder);
+
+    size_t decompressedSize = enet_range_coder_decompress(
+        rangeCoder, &compressed[0], compressed.size(), &data[0], size);
+    enet_range_coder_destroy(rangeCoder);
+
+    return decompressedSize == size;
+}
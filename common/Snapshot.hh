@@ -0,0 +1,23 @@
+#ifndef STRAT_COMMON_SNAPSHOT_HH
+#define STRAT_COMMON_SNAPSHOT_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Snapshots of the simulation state (see Sim::save) are sent to clients
+// that rejoin a running match. They are compressed with the range coder
+// that ENet uses for packets, and sent in chunks of SNAPSHOT_CHUNK_SIZE
+// bytes, so that a large state does not hold up other traffic.
+const size_t SNAPSHOT_CHUNK_SIZE = 4096;
+
+// Data that the range coder cannot make smaller is stored as is,
+// which is recognized by the compressed size being the full size
+void compressSnapshot(const std::vector<uint8_t> &data,
+                      std::vector<uint8_t> &compressed);
+
+// Returns false if the compressed data is corrupt
+bool decompressSnapshot(const std::vector<uint8_t> &compressed, size_t size,
+                        std::vector<uint8_t> &data);
+
+#endif
@@ -1,27 +1,57 @@
 #include "Client.hh"
 #include "common/BitStream.hh"
+#include "common/Snapshot.hh"
+#include "util/Log.hh"
 #include "util/Profiling.hh"
 
 #include <GLFW/glfw3.h>
 
-#include <stdexcept>
 #include <iostream>
+#include <sstream>
 #include <cassert>
 
+static const double ORDER_FLUSH_DELAY_S = 0.02;
+
+static const double STATS_INTERVAL_S = 10.0;
+
 Client::Client(const std::string &username)
     : username(username),
-      client(NULL),
-      peer(NULL),
+      matchId(0),
+      rejoinToken(0),
+      awaitingSnapshot(false),
+      fastForwarding(false),
+      rejoinStartS(0),
+      fastForwardTicks(0),
       sim(NULL),
+      prediction(NULL),
       playerId(0), 
+      orderCounter(0),
+      outgoingOrdersAge(0),
       tickRunning(false),
       interp(settings),
-      haveQueuedTick(false) {
+      tickShown(true),
+      tickQueue(settings, MAX_CLIENT_LAG / 2),
+      timeS(0),
+      ticksReceived(0),
+      ticksDone(0),
+      inputDelay(2),
+      ticksRecovered(0),
+      duplicateTicks(0),
+      lastStatsS(0),
+      statsFile(NULL),
+      replayKeyframeInterval(0),
+      replay(NULL) {
 }
 
 Client::~Client() {
-    if (client)
-        enet_host_destroy(client);
+    if (replay)
+        delete replay;
+
+    if (statsFile)
+        delete statsFile;
+
+    if (prediction)
+        delete prediction;
 
     if (sim)
         delete sim;
@@ -30,131 +60,483 @@ Client::~Client() {
 void Client::connect(const std::string &host, int port) {
     std::cout << "Connecting to " << host << ":" << port << std::endl;
 
-    client = enet_host_create(NULL, 1, 2, 0, 0);
+    network.connect(host, port);
 
-    if (client == NULL)
-        throw std::runtime_error("Failed to create ENet client");
+    sendHello();
+}
 
-    ENetAddress address;
-    enet_address_set_host(&address, host.c_str());
-    address.port = port;
+void Client::rejoin(uint32_t matchId, PlayerId playerId,
+                    uint64_t rejoinToken) {
+    assert(!sim);
 
-    peer = enet_host_connect(client, &address, 2, 0);
+    this->matchId = matchId;
+    this->playerId = playerId;
+    this->rejoinToken = rejoinToken;
+}
 
-    ENetEvent event;
-    if (enet_host_service(client, &event, 5000) > 0 &&
-        event.type == ENET_EVENT_TYPE_CONNECT) {
-        std::cout << "Connected!" << std::endl;
-    } else {
-        enet_peer_reset(peer);
+void Client::sendHello() {
+    Message message(Message::CLIENT_CONNECT);
+    message.client_connect.name = username;
 
-        throw std::runtime_error("Failed to connect");
+    if (matchId != 0) {
+        std::cout << "Rejoining match " << matchId << " as player "
+                  << playerId << std::endl;
+
+        message.client_connect.matchId = matchId;
+        message.client_connect.playerId = playerId;
+        message.client_connect.rejoinToken = rejoinToken;
+
+        // Everything we knew about the ticks is void now
+        awaitingSnapshot = true;
+        fastForwarding = false;
+        tickRunning = false;
+        tickQueue.clear();
+        outgoingOrders.clear();
+        latencyTrace.clear();
+        rejoinStartS = timeS;
+        fastForwardTicks = 0;
+
+        if (replay) {
+            std::cout << "Stopping the replay, since it would have a gap"
+                      << std::endl;
+            delete replay;
+            replay = NULL;
+        }
     }
 
-    // Say hello
-    Message message(Message::CLIENT_CONNECT);
-    message.client_connect.name = username;
     sendMessage(message);
 }
 
+void Client::record(const std::string &filename, size_t keyframeInterval) {
+    assert(!sim);
+
+    replayFilename = filename;
+    replayKeyframeInterval = keyframeInterval;
+}
+
+void Client::writeStats(const std::string &filename) {
+    assert(!statsFile);
+
+    statsFile = new StatsFile(filename);
+    if (!statsFile->isOpen())
+        WARN(client) << "Failed to open " << filename;
+}
+
 void Client::update(double dt) {
+    if (!tickShown) {
+        latencyTrace.shown(NetworkThread::Clock::now());
+        tickShown = true;
+    }
+
     interp.update(dt);
+    timeS += dt;
+
+    if (!outgoingOrders.empty())
+        outgoingOrdersAge += dt;
 
     if (tickRunning && interp.isTickDone()) {
         tickRunning = false;
-
-        // Inform the server that we have completed a tick
-        Message message(Message::CLIENT_TICK_DONE);
-        sendMessage(message);
+        finishTick();
 
         // Start queued tick if we already received one
-        if (haveQueuedTick) {
-            sim->runTick(queuedOrders);
-            interp.startTick();
-            tickRunning = true;
-            haveQueuedTick = false;
-        }
+        runQueuedTicks();
     }
 
     /*if (!tickRunning)
         std::cout << "WAITING FOR TICK" << std::endl;*/
 
-    ENetEvent event;
-    while (enet_host_service(client, &event, 0) > 0) {
-        switch (event.type) {
-        case ENET_EVENT_TYPE_CONNECT:
-            break;
-        case ENET_EVENT_TYPE_RECEIVE: {
-            BitStreamReader reader(event.packet->data, event.packet->dataLength);
+    if (outgoingOrdersAge >= ORDER_FLUSH_DELAY_S)
+        flushOrders();
 
-            Message::Type messageType;
-            read(reader, messageType);
+    if (sim && timeS - lastStatsS >= STATS_INTERVAL_S)
+        logStats();
 
-            Message message(messageType);
-            read(reader, message);
-
-            handleMessage(message);
+    NetworkThread::Event event;
+    while (network.poll(event)) {
+        switch (event.type) {
+        case NetworkThread::Event::CONNECTED:
+            // We have reconnected
+            sendHello();
+            break;
+        case NetworkThread::Event::RECEIVED: {
+            // The message may have been waiting for this frame for a while
+            double waitS = std::chrono::duration<double>(
+                NetworkThread::Clock::now() - event.time).count();
 
-            enet_packet_destroy(event.packet);
+            handleMessage(event.message, event.channel, timeS - waitS,
+                          event.time);
             break;
         }
-        case ENET_EVENT_TYPE_DISCONNECT:
-            std::cout << "Got disconnected" << std::endl;
+        case NetworkThread::Event::DISCONNECTED:
+            if (matchId == 0) {
+                std::cout << "Got disconnected" << std::endl;
+                break;
+            }
+
+            // Keep trying, failed attempts end up here as well
+            std::cout << "Got disconnected, reconnecting" << std::endl;
+            network.reconnect();
             break;
         default: assert(false);
         }
     }
 }
 
+void Client::dumpNetworkStats() {
+    INFO(client) << ticksReceived << " ticks received, "
+                 << ticksRecovered << " recovered through redundancy, "
+                 << duplicateTicks << " duplicates";
+
+    ticksRecovered = 0;
+    duplicateTicks = 0;
+
+    tickQueue.dumpStats();
+    network.dumpStats();
+    logStats();
+}
+
+void Client::logStats() {
+    lastStatsS = timeS;
+
+    PeerStats current = network.takeStats();
+    current.tickLag = stats.tickLag;
+    current.tickLead = stats.tickLead;
+    stats = PeerStats();
+
+    INFO(client) << current;
+    INFO(client) << "Order latency: " << latencyTrace.getStats();
+
+    if (statsFile) {
+        std::ostringstream out;
+        out << "{\"timeMs\":" << wallTimeMs()
+            << ",\"source\":\"client\",\"match\":" << matchId
+            << ",\"player\":" << playerId
+            << ",\"ticksDone\":" << ticksDone
+            << ",\"jitterBufferS\":" << tickQueue.getJitterS()
+            << ",\"stats\":";
+        writeJson(out, current);
+        out << ",\"orderLatency\":";
+        writeJson(out, latencyTrace.getStats());
+        out << "}";
+
+        statsFile->write(out.str());
+    }
+
+    latencyTrace.resetStats();
+}
+
 void Client::order(const Order &order) {
     assert(sim);
 
+    if (awaitingSnapshot)
+        return;
+
     Order o(order);
     o.player = playerId;
 
     if (sim->getState().isOrderValid(o)) {
-        Message message(Message::CLIENT_ORDER);
-        message.client_order.order = o;
-        sendMessage(message);
+        o.seq = ++orderCounter;
+        latencyTrace.issued(o.seq, NetworkThread::Clock::now());
+
+        // Merging only with the last order keeps the execution order intact
+        if (!outgoingOrders.empty() && outgoingOrders.back().canMerge(o))
+            outgoingOrders.back().merge(o);
+        else
+            outgoingOrders.push_back(o);
+
+        prediction->addOrder(o);
+    }
+}
+
+void Client::flushOrders() {
+    outgoingOrdersAge = 0;
+
+    if (outgoingOrders.empty())
+        return;
+
+    for (auto &order : outgoingOrders)
+        order.tick = ticksDone + inputDelay;
+
+    Message message(Message::CLIENT_ORDERS);
+    message.client_orders.orders.assign(outgoingOrders.begin(),
+                                        outgoingOrders.end());
+    sendMessage(message);
+    latencyTrace.flushed(NetworkThread::Clock::now());
+
+    outgoingOrders.clear();
+}
+
+void Client::runTick(const std::vector<Order> &orders, bool interpolate) {
+    auto now = NetworkThread::Clock::now();
+    for (auto &order : orders) {
+        if (order.player == playerId)
+            latencyTrace.started(order.seq, now);
+    }
+
+    sim->runTick(orders);
+    prediction->confirmTick(orders);
+
+    ticksDone++;
+
+    if (replay) {
+        replay->writeTick(ticksDone, orders);
+
+        if (replay->wantsKeyframe(ticksDone))
+            writeKeyframe();
+    }
+
+    tickShown = false;
+
+    if (interpolate) {
+        interp.startTick();
+        tickRunning = true;
+    } else {
+        finishTick();
+    }
+}
+
+void Client::finishTick() {
+    // Our orders should make it into the next tick, so send them first
+    flushOrders();
+
+    // Inform the server that we have completed a tick
+    Message message(Message::CLIENT_TICK_DONE);
+    sendMessage(message);
+}
+
+void Client::runQueuedTicks() {
+    if (!sim)
+        return;
+
+    // Ticks that we need to catch up on are executed right away,
+    // the first regular one is interpolated
+    bool catchUp;
+    while (!tickRunning && tickQueue.pop(tickOrders, catchUp)) {
+        stats.tickLead.add(tickQueue.size());
+        runTick(tickOrders, !catchUp);
+    }
+}
+
+void Client::writeKeyframe() {
+    assert(replay);
+
+    PROFILE(keyframe);
+
+    BitStreamWriter writer;
+    sim->save(writer);
+    replay->writeKeyframe(ticksDone, writer.ptr(), writer.size());
+}
+
+void Client::sendSnapshot() {
+    PROFILE(snapshot);
+
+    BitStreamWriter writer;
+    sim->save(writer);
+
+    std::vector<uint8_t> data(writer.ptr(), writer.ptr() + writer.size());
+    std::vector<uint8_t> compressed;
+    compressSnapshot(data, compressed);
+
+    INFO(client) << "Sending snapshot of tick " << ticksDone << ": "
+                 << compressed.size() << " bytes (" << data.size()
+                 << " uncompressed)";
+
+    for (size_t offset = 0; offset < compressed.size() || offset == 0;
+         offset += SNAPSHOT_CHUNK_SIZE) {
+        size_t end = std::min(offset + SNAPSHOT_CHUNK_SIZE, compressed.size());
+
+        Message message(Message::CLIENT_SNAPSHOT);
+        message.snapshot_chunk.tick = ticksDone;
+        message.snapshot_chunk.size = data.size();
+        message.snapshot_chunk.compressedSize = compressed.size();
+        message.snapshot_chunk.offset = offset;
+        message.snapshot_chunk.data.assign(compressed.begin() + offset,
+                                           compressed.begin() + end);
+        sendMessage(message, CHANNEL_BULK);
     }
 }
 
-void Client::sendMessage(const Message &message) {
-    ENetPacket *packet = message.toPacket();
-    enet_peer_send(peer, 0, packet);
+void Client::receiveSnapshot(const Message::SnapshotChunk &chunk) {
+    if (!awaitingSnapshot)
+        return;
+
+    // The server starts over if the client sending the snapshot goes away
+    if (chunk.offset == 0)
+        snapshotData.clear();
+
+    if (chunk.offset != snapshotData.size())
+        return;
+
+    snapshotData.insert(snapshotData.end(), chunk.data.begin(), chunk.data.end());
+
+    if (snapshotData.size() < chunk.compressedSize)
+        return;
+
+    // The server asks another client if we can not use this one
+    std::vector<uint8_t> data;
+    if (!decompressSnapshot(snapshotData, chunk.size, data)) {
+        WARN(client) << "Received a corrupt snapshot";
+        rejectSnapshot();
+        return;
+    }
+
+    BitStreamReader reader(data);
+    sim->load(reader);
+    if (reader.hasFailed() || !reader.eof()) {
+        WARN(client) << "Received a malformed snapshot of tick " << chunk.tick;
+        rejectSnapshot();
+        return;
+    }
+
+    prediction->reset();
+
+    ticksDone = chunk.tick;
+    ticksReceived = chunk.tick;
+
+    awaitingSnapshot = false;
+    fastForwarding = true;
+
+    INFO(client) << "Loaded snapshot of tick " << chunk.tick << ": "
+                 << chunk.compressedSize << " bytes (" << chunk.size
+                 << " uncompressed), " << (timeS - rejoinStartS)
+                 << "s after rejoining";
+}
+
+void Client::rejectSnapshot() {
+    snapshotData.clear();
+    sendMessage(Message(Message::CLIENT_SNAPSHOT_FAILED));
+}
+
+void Client::sendMessage(const Message &message, enet_uint8 channel) {
+    network.send(message, channel);
 }
 
-void Client::handleMessage(const Message &message) {
+void Client::handleMessage(const Message &message, enet_uint8 channel,
+                           double arrivalS,
+                           NetworkThread::Clock::time_point arrivalTime) {
     switch (message.type) {
     case Message::SERVER_CONNECT:
         std::cout << "Connected to server with player id "
-                  << message.server_connect.yourPlayerId << std::endl;
+                  << message.server_connect.yourPlayerId << " in match "
+                  << message.server_connect.matchId << " (rejoin token "
+                  << message.server_connect.rejoinToken << ")" << std::endl;
         playerId = message.server_connect.yourPlayerId;
+        matchId = message.server_connect.matchId;
+        rejoinToken = message.server_connect.rejoinToken;
+        return;
+
+    case Message::SERVER_SNAPSHOT_REQUEST:
+        if (sim && !awaitingSnapshot)
+            sendSnapshot();
+        return;
+
+    case Message::SERVER_SNAPSHOT:
+        receiveSnapshot(message.snapshot_chunk);
         return;
 
     case Message::SERVER_START:
+        // When we reconnect, our simulation is replaced by the snapshot
+        if (sim)
+            return;
+
         std::cout << "Initializing simulation with seed "
                   << message.server_start.settings.randomSeed << std::endl;
 
         settings = message.server_start.settings;
         sim = new Sim(settings);
+        // Our orders take longer to come back when the tick queue is deep
+        prediction = new Prediction(settings, *sim, playerId, inputDelay,
+                                    MAX_CLIENT_LAG + 8);
+
+        if (awaitingSnapshot) {
+            if (!replayFilename.empty())
+                std::cout << "Not recording a replay of a running match"
+                          << std::endl;
+            return;
+        }
+
+        if (!replayFilename.empty()) {
+            std::cout << "Recording replay to " << replayFilename << std::endl;
+            replay = new ReplayWriter(replayFilename, settings,
+                                      replayKeyframeInterval);
+            writeKeyframe();
+        }
+
+        // Ticks may have overtaken the start message
+        runQueuedTicks();
         return;
 
-    case Message::SERVER_TICK:
-        assert(!haveQueuedTick);
-
-        if (sim) {
-            if (!tickRunning) {
-                sim->runTick(message.server_tick.orders);
-                interp.startTick();
-                tickRunning = true;
-            } else {
-                queuedOrders = message.server_tick.orders;
-                haveQueuedTick = true;
-                //std::cout << "Queued tick at t=" << interp.getT() << std::endl;
+    case Message::SERVER_TICK: {
+        const Message::ServerTick &serverTick = message.server_tick;
+        size_t firstTick = serverTick.tick + 1 - serverTick.ticks.size();
+
+        if (awaitingSnapshot)
+            return;
+
+        inputDelay = serverTick.inputDelay;
+        tickQueue.setDepthLimit(inputDelay);
+        if (prediction)
+            prediction->setLead(inputDelay);
+
+        if (serverTick.tick > ticksDone)
+            stats.tickLag.add(serverTick.tick - ticksDone);
+        else
+            stats.tickLag.add(0);
+
+        if (!serverTick.ticks.empty() &&
+            serverTick.holdUs.size() == serverTick.ticks.back().size()) {
+            const TickOrders &newest = serverTick.ticks.back();
+
+            for (size_t i = 0; i < newest.size(); i++) {
+                if (newest[i].player == playerId)
+                    latencyTrace.received(newest[i].seq, arrivalTime,
+                                          serverTick.holdUs[i]);
             }
         }
+
+        for (size_t i = 0; i < serverTick.ticks.size(); i++) {
+            size_t tick = firstTick + i;
+
+            if (tick <= ticksReceived) {
+                duplicateTicks++;
+                continue;
+            }
+
+            // We missed a tick that is not repeated here. The server sends
+            // its whole history again once it notices that we are stuck.
+            if (tick > ticksReceived + 1)
+                break;
+
+            if (tick < serverTick.tick)
+                ticksRecovered++;
+
+            ticksReceived = tick;
+            tickOrders.assign(serverTick.ticks[i].begin(),
+                              serverTick.ticks[i].end());
+
+            if (fastForwarding) {
+                fastForwardTicks++;
+                runTick(tickOrders, false);
+                continue;
+            }
+
+            tickQueue.push(tickOrders, arrivalS);
+        }
+
+        // Once the regular tick messages have nothing new for us,
+        // we are back to normal playback
+        if (fastForwarding && channel == CHANNEL_TICKS &&
+            ticksReceived >= serverTick.tick) {
+            fastForwarding = false;
+
+            INFO(client) << "Caught up with the match after "
+                         << (timeS - rejoinStartS) << "s, fast-forwarded "
+                         << fastForwardTicks << " ticks";
+        }
+
+        runQueuedTicks();
         return;
+    }
 
     default:
         return;
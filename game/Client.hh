@@ -3,7 +3,13 @@
 
 #include "Sim.hh"
 #include "InterpState.hh"
+#include "LatencyTrace.hh"
+#include "NetworkThread.hh"
+#include "Prediction.hh"
+#include "TickQueue.hh"
 #include "common/Message.hh"
+#include "common/NetStats.hh"
+#include "common/Replay.hh"
 
 #include <enet/enet.h>
 #include <entityx/entityx.h>
@@ -15,12 +21,40 @@
 //
 // Everytime the server sends a tick to the client, it is
 // executed in the local simulation.
+//
+// Our own orders are additionally executed right away in a predicted
+// copy of the simulation, which is what should be shown to the player.
+//
+// Received ticks go through a jitter buffer (see TickQueue) before they
+// are executed. The connection itself is handled on a separate thread
+// (see NetworkThread), which sends our acks as soon as we queue them.
+//
+// Orders are not sent individually. They are buffered and sent once per tick,
+// with repeated orders merged into one. Their way through the client, the
+// network and the server is traced (see LatencyTrace).
+//
+// If the connection is lost, we reconnect and rejoin the match: the server
+// sends a snapshot of the simulation from another client and the ticks
+// since then, which we execute without interpolation until we have
+// caught up.
 struct Client {
     Client(const std::string &username);
     ~Client();
 
     void connect(const std::string &host, int port);
 
+    // Takes over a player of a running match instead of joining a new one,
+    // with the token the server gave that player. Call before connect().
+    void rejoin(uint32_t matchId, PlayerId playerId, uint64_t rejoinToken);
+
+    // Records the match to a replay file once it starts,
+    // storing the simulation state every `keyframeInterval' ticks
+    void record(const std::string &filename, size_t keyframeInterval);
+
+    // Appends the network stats to a file as a line of JSON whenever
+    // they are logged
+    void writeStats(const std::string &filename);
+
     Sim &getSim() {
         assert(sim != NULL);
         return *sim;
@@ -31,8 +65,25 @@ struct Client {
         return *sim;
     }    
 
+    Sim &getPredictedSim() {
+        assert(prediction != NULL);
+        return prediction->getSim();
+    }
+
+    Prediction &getPrediction() {
+        assert(prediction != NULL);
+        return *prediction;
+    }
+
     void update(double dt);
 
+    // Logs the counters of tick delivery and resets them
+    void dumpNetworkStats();
+
+    // Logs a summary of the connection and resets it; also called
+    // every STATS_INTERVAL_S while playing
+    void logStats();
+
     void order(const Order &order);
 
     bool isStarted() const {
@@ -51,22 +102,86 @@ struct Client {
 private:
     std::string username;
 
-    ENetHost *client;
-    ENetPeer *peer;
+    NetworkThread network;
+
+    uint32_t matchId;
+    uint64_t rejoinToken;
+
+    // Waiting for the snapshot after rejoining a match
+    bool awaitingSnapshot;
+    std::vector<uint8_t> snapshotData;
+
+    // Executing the ticks since the snapshot without interpolation
+    bool fastForwarding;
+    double rejoinStartS;
+    size_t fastForwardTicks;
 
     GameSettings settings;
     Sim *sim;
+    Prediction *prediction;
 
     PlayerId playerId;
+    uint32_t orderCounter;
+
+    // Orders are collected and sent as one message, either together with
+    // the completion of the current tick or after at most ORDER_FLUSH_DELAY_S
+    std::vector<Order> outgoingOrders;
+    double outgoingOrdersAge;
 
     bool tickRunning;
     InterpState interp;
 
-    bool haveQueuedTick;
-    std::vector<Order> queuedOrders;
+    // Whether a frame has been rendered since the last tick was started.
+    // update() runs before each frame, so the next call notices it.
+    bool tickShown;
+
+    // Ticks that have been received but not yet started. tickOrders passes
+    // ticks in and out of the queue, trading memory instead of allocating.
+    TickQueue tickQueue;
+    std::vector<Order> tickOrders;
+
+    // Time since the start, for measuring the arrival of ticks
+    double timeS;
+
+    size_t ticksReceived;
+    size_t ticksDone;
+
+    // Our orders are requested for this many ticks after ticksDone,
+    // as announced by the server
+    size_t inputDelay;
+
+    // Ticks whose own message was lost, but which were repeated in a later one
+    size_t ticksRecovered;
+    size_t duplicateTicks;
+
+    // Tick lag and lead; the network thread has the rest
+    PeerStats stats;
+    LatencyTrace latencyTrace;
+    double lastStatsS;
+    StatsFile *statsFile;
+
+    std::string replayFilename;
+    size_t replayKeyframeInterval;
+    ReplayWriter *replay;
+
+    void writeKeyframe();
+
+    void flushOrders();
+
+    void runTick(const std::vector<Order> &, bool interpolate);
+    void runQueuedTicks();
+    void finishTick();
+
+    void sendHello();
+    void sendSnapshot();
+    void receiveSnapshot(const Message::SnapshotChunk &);
+    void rejectSnapshot();
 
-    void sendMessage(const Message &);
-    void handleMessage(const Message &);
+    void sendMessage(const Message &, enet_uint8 channel = CHANNEL_CONTROL);
+    // `arrivalS' and `arrivalTime' are when the network thread received
+    // the message, in our time and in real time
+    void handleMessage(const Message &, enet_uint8 channel, double arrivalS,
+                       NetworkThread::Clock::time_point arrivalTime);
 };
 
 #endif
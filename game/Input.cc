@@ -48,7 +48,7 @@ static Ray calculateViewRay(double mx, double my, int width, int height,
 Input::Input(const Config &config, GLFWwindow *window, Client &client,
              entityx::EventManager &events)
     : config(config), window(window),
-      client(client), sim(client.getSim()),
+      client(client), sim(client.getPredictedSim()),
       map(sim.getState().getMap()),
       mode(DefaultMode()),
       scrollSpeed(5.0f) {
@@ -216,34 +216,54 @@ void Input::onMouseButton(GLFWwindow *window,
     }
 }
 
+// With shift held, an order commands the whole fleet instead of the first ship
+static void selectUnits(Client &client, int mods, Order &order) {
+    if (!(mods & GLFW_MOD_SHIFT))
+        return;
+
+    const PlayerState &player(
+        client.getSim().getState().getPlayer(client.getPlayerId()));
+    if (!player.units.empty())
+        order.units.addRange(0, player.units.size());
+}
+
 void Input::onKey(GLFWwindow *window, int key, int, int action, int mods) {
     if (action == GLFW_PRESS && key == GLFW_KEY_P)
         ProfilingData::dump();
 
     if (Input *self = g_input) {
+        if (action == GLFW_PRESS && key == GLFW_KEY_P) {
+            self->client.getPrediction().dumpStats();
+            self->client.dumpNetworkStats();
+        }
+
         match(self->mode,
             [&](const DefaultMode &) {
                 if (action == GLFW_PRESS && key == GLFW_KEY_UP) {
                     Order order(Order::ACCELERATE);
                     order.accelerate.direction = DIRECTION_FORWARD;
+                    selectUnits(self->client, mods, order);
 
                     self->client.order(order);
                 }
                 if (action == GLFW_PRESS && key == GLFW_KEY_DOWN) {
                     Order order(Order::ACCELERATE);
                     order.accelerate.direction = DIRECTION_BACKWARD;
+                    selectUnits(self->client, mods, order);
 
                     self->client.order(order);
                 }
                 if (action == GLFW_PRESS && key == GLFW_KEY_LEFT) {
                     Order order(Order::ACCELERATE);
                     order.accelerate.direction = DIRECTION_LEFT;
+                    selectUnits(self->client, mods, order);
 
                     self->client.order(order);
                 }
                 if (action == GLFW_PRESS && key == GLFW_KEY_RIGHT) {
                     Order order(Order::ACCELERATE);
                     order.accelerate.direction = DIRECTION_RIGHT;
+                    selectUnits(self->client, mods, order);
 
                     self->client.order(order);
                 }
@@ -0,0 +1,132 @@
+#include "LatencyTrace.hh"
+
+#include <algorithm>
+#include <cassert>
+
+// Orders in flight beyond this many are forgotten, oldest first
+static const size_t MAX_TRACES = 1024;
+
+static double millisecondsBetween(LatencyTrace::Clock::time_point from,
+                                  LatencyTrace::Clock::time_point to) {
+    return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+void LatencyTrace::issued(uint32_t seq, Clock::time_point time) {
+    assert(traces.empty() || traces.back().seq < seq);
+
+    Trace trace;
+    trace.seq = seq;
+    trace.wasFlushed = false;
+    trace.wasReceived = false;
+    trace.wasStarted = false;
+    trace.issueTime = time;
+    trace.serverHoldUs = 0;
+
+    traces.push_back(trace);
+
+    if (traces.size() > MAX_TRACES)
+        traces.pop_front();
+}
+
+void LatencyTrace::flushed(Clock::time_point time) {
+    for (auto &trace : traces) {
+        if (!trace.wasFlushed) {
+            trace.wasFlushed = true;
+            trace.flushTime = time;
+        }
+    }
+}
+
+void LatencyTrace::received(uint32_t seq, Clock::time_point time,
+                            uint32_t serverHoldUs) {
+    Trace *trace = find(seq);
+    if (!trace || !trace->wasFlushed || trace->wasReceived)
+        return;
+
+    trace->wasReceived = true;
+    trace->receiveTime = time;
+    trace->serverHoldUs = serverHoldUs;
+}
+
+void LatencyTrace::started(uint32_t seq, Clock::time_point time) {
+    // The server executes our orders in sequence, so the earlier ones that
+    // have not been started will never be: they were merged or dropped
+    traces.erase(std::remove_if(traces.begin(), traces.end(),
+        [&](const Trace &trace) {
+            return trace.seq < seq && !trace.wasStarted;
+        }), traces.end());
+
+    Trace *trace = find(seq);
+    if (!trace)
+        return;
+
+    // Without the echo of the server, the stages can not be told apart
+    if (!trace->wasReceived) {
+        traces.erase(std::find_if(traces.begin(), traces.end(),
+            [&](const Trace &t) { return t.seq == seq; }));
+        return;
+    }
+
+    trace->wasStarted = true;
+    trace->startTime = time;
+}
+
+void LatencyTrace::shown(Clock::time_point time) {
+    while (!traces.empty() && traces.front().wasStarted) {
+        const Trace &trace = traces.front();
+
+        double serverMs = trace.serverHoldUs / 1000.0;
+        double roundTripMs = millisecondsBetween(trace.flushTime,
+                                                 trace.receiveTime);
+
+        stats.queueingMs.add(millisecondsBetween(trace.issueTime,
+                                                 trace.flushTime));
+        stats.networkMs.add(std::max(roundTripMs - serverMs, 0.0));
+        stats.serverMs.add(serverMs);
+        stats.tickWaitMs.add(millisecondsBetween(trace.receiveTime,
+                                                 trace.startTime));
+        stats.displayMs.add(millisecondsBetween(trace.startTime, time));
+        stats.totalMs.add(millisecondsBetween(trace.issueTime, time));
+
+        traces.pop_front();
+    }
+}
+
+void LatencyTrace::clear() {
+    traces.clear();
+}
+
+LatencyTrace::Trace *LatencyTrace::find(uint32_t seq) {
+    for (auto &trace : traces) {
+        if (trace.seq == seq)
+            return &trace;
+    }
+
+    return NULL;
+}
+
+std::ostream &operator<<(std::ostream &os, const LatencyTrace::Stats &stats) {
+    return os << stats.totalMs.count << " orders traced, "
+              << "total " << stats.totalMs << "ms; "
+              << "queueing " << stats.queueingMs << "ms; "
+              << "network " << stats.networkMs << "ms; "
+              << "server " << stats.serverMs << "ms; "
+              << "tick wait " << stats.tickWaitMs << "ms; "
+              << "display " << stats.displayMs << "ms";
+}
+
+void writeJson(std::ostream &os, const LatencyTrace::Stats &stats) {
+    os << "{\"totalMs\":";
+    writeJson(os, stats.totalMs);
+    os << ",\"queueingMs\":";
+    writeJson(os, stats.queueingMs);
+    os << ",\"networkMs\":";
+    writeJson(os, stats.networkMs);
+    os << ",\"serverMs\":";
+    writeJson(os, stats.serverMs);
+    os << ",\"tickWaitMs\":";
+    writeJson(os, stats.tickWaitMs);
+    os << ",\"displayMs\":";
+    writeJson(os, stats.displayMs);
+    os << "}";
+}
@@ -0,0 +1,90 @@
+#ifndef STRAT_GAME_LATENCY_TRACE_HH
+#define STRAT_GAME_LATENCY_TRACE_HH
+
+#include "common/NetStats.hh"
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <ostream>
+
+// Traces our own orders from issuing them until their tick has been
+// executed and shown, and splits the latency into stages:
+//
+// - queueing: until the order is handed to the network thread, which
+//   happens once per tick or after at most ORDER_FLUSH_DELAY_S
+// - network: the round trip to the server and back, without the time
+//   the server held the order
+// - server: from the server receiving the order until it started the
+//   tick, as echoed in the SERVER_TICK (see Message::ServerTick::holdUs)
+// - tick wait: from receiving the tick until executing it, i.e. waiting
+//   in the jitter buffer and for the previous tick to finish
+// - display: from executing the tick until the first frame showing it
+//   has been rendered
+//
+// Orders are identified by their Order::seq. Orders that were merged into
+// a later one or dropped by the server are not traced.
+//
+// This is the latency of the authoritative simulation; the predicted one
+// that is rendered shows our orders right away.
+struct LatencyTrace {
+    typedef std::chrono::steady_clock Clock;
+
+    struct Stats {
+        Histogram queueingMs;
+        Histogram networkMs;
+        Histogram serverMs;
+        Histogram tickWaitMs;
+        Histogram displayMs;
+        Histogram totalMs;
+    };
+
+    void issued(uint32_t seq, Clock::time_point);
+
+    // All orders issued so far have been sent
+    void flushed(Clock::time_point);
+
+    // Our order arrived in the newest tick of a SERVER_TICK
+    void received(uint32_t seq, Clock::time_point, uint32_t serverHoldUs);
+
+    // The tick containing our order is being executed
+    void started(uint32_t seq, Clock::time_point);
+
+    // A frame showing the ticks that have been started so far has been
+    // rendered
+    void shown(Clock::time_point);
+
+    // Forgets all orders in flight, e.g. after losing the connection
+    void clear();
+
+    const Stats &getStats() const { return stats; }
+    void resetStats() { stats = Stats(); }
+
+private:
+    struct Trace {
+        uint32_t seq;
+
+        bool wasFlushed;
+        bool wasReceived;
+        bool wasStarted;
+
+        Clock::time_point issueTime;
+        Clock::time_point flushTime;
+        Clock::time_point receiveTime;
+        Clock::time_point startTime;
+
+        uint32_t serverHoldUs;
+    };
+
+    // Orders in flight, ordered by seq
+    std::deque<Trace> traces;
+
+    Stats stats;
+
+    Trace *find(uint32_t seq);
+};
+
+std::ostream &operator<<(std::ostream &, const LatencyTrace::Stats &);
+void writeJson(std::ostream &, const LatencyTrace::Stats &);
+
+#endif
@@ -30,6 +30,35 @@ int main(int argc, char *argv[]) {
 
     Config config;
 
+    std::string replayFilename;
+    size_t replayKeyframeInterval = 100;
+    uint32_t rejoinMatchId = 0;
+    PlayerId rejoinPlayerId = 0;
+    uint64_t rejoinToken = 0;
+    std::string statsFilename;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+
+        if (arg == "--record" && i + 1 < argc) {
+            replayFilename = argv[++i];
+        } else if (arg == "--keyframe-interval" && i + 1 < argc) {
+            replayKeyframeInterval = strtoul(argv[++i], NULL, 10);
+        } else if (arg == "--rejoin" && i + 3 < argc) {
+            rejoinMatchId = strtoul(argv[++i], NULL, 10);
+            rejoinPlayerId = strtoul(argv[++i], NULL, 10);
+            rejoinToken = strtoull(argv[++i], NULL, 10);
+        } else if (arg == "--stats" && i + 1 < argc) {
+            statsFilename = argv[++i];
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--record FILE]"
+                      << " [--keyframe-interval N]"
+                      << " [--rejoin MATCH PLAYER TOKEN]"
+                      << " [--stats FILE]" << std::endl;
+            return 1;
+        }
+    }
+
     if (!glfwInit()) {
         std::cerr << "GLFW initialization failed" << std::endl;
         return 1;
@@ -59,6 +88,12 @@ int main(int argc, char *argv[]) {
     }
 
     Client client("leo");
+    if (!replayFilename.empty())
+        client.record(replayFilename, replayKeyframeInterval);
+    if (rejoinMatchId != 0)
+        client.rejoin(rejoinMatchId, rejoinPlayerId, rejoinToken);
+    if (!statsFilename.empty())
+        client.writeStats(statsFilename);
     client.connect("localhost", 1234);
 
     std::cout << "Waiting for the game to start" << std::endl;
@@ -68,6 +103,7 @@ int main(int argc, char *argv[]) {
     std::cout << "Game started" << std::endl;
 
     Sim &sim(client.getSim());
+    Sim &predictedSim(client.getPredictedSim());
     const SimState &simState(sim.getState());
     const Map &map(simState.getMap());
     const Water &water(simState.getWater());
@@ -117,10 +153,10 @@ int main(int argc, char *argv[]) {
             glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
             glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-            graphics.renderShadowMap(sim.getEntities(), interp);
+            graphics.renderShadowMap(predictedSim.getEntities(), interp);
 
             graphics.setup(view);
-            graphics.render(sim.getEntities(), interp);
+            graphics.render(predictedSim.getEntities(), interp);
 
             graphics.debugRender();
 
@@ -1,8 +1,8 @@
 #include "Map.hh"
 
 #include "util/Math.hh"
+#include "common/BitStream.hh"
 
-#include <cstdlib>
 
 Map::Map(size_t sizeX, size_t sizeY)
     : sizeX(sizeX),
@@ -19,13 +19,10 @@ Map::Map(size_t sizeX, size_t sizeY)
 } 
 
 Map Map::generate(size_t sizeX, size_t sizeY,
-                  size_t heightLimit, size_t seed) {
-    // HACK: Maybe use C++11's random generators to ensure determinism
-    srand(seed);
-
+                  size_t heightLimit, const Random &random) {
     Map map(sizeX, sizeY);
 
-    PerlinNoise noise(sizeX, sizeY);
+    PerlinNoise noise(sizeX, sizeY, random);
     noise.generate(8, 0.4);
 
     size_t minHeight = heightLimit;
@@ -59,3 +56,33 @@ Map Map::generate(size_t sizeX, size_t sizeY,
 void Map::tick(fixed tickLengthS) {
 }
 
+
+void read(BitStreamReader &reader, Map &map) {
+    uint32_t sizeX, sizeY, maxHeight;
+    read(reader, sizeX);
+    read(reader, sizeY);
+    read(reader, maxHeight);
+
+    if (sizeX != map.sizeX || sizeY != map.sizeY) {
+        reader.fail();
+        return;
+    }
+
+    map.maxHeight = maxHeight;
+
+    for (auto &point : map.points) {
+        uint32_t height;
+        read(reader, height);
+        point.height = height;
+        point.dirty = true;
+    }
+}
+
+void write(BitStreamWriter &writer, const Map &map) {
+    write(writer, static_cast<uint32_t>(map.sizeX));
+    write(writer, static_cast<uint32_t>(map.sizeY));
+    write(writer, static_cast<uint32_t>(map.maxHeight));
+
+    for (auto &point : map.points)
+        write(writer, static_cast<uint32_t>(point.height));
+}
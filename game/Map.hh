@@ -2,6 +2,7 @@
 #define STRAT_GAME_MAP_HH
 
 #include "util/Fixed.hh"
+#include "util/Random.hh"
 
 #include <entityx/entityx.h>
 #include <glm/glm.hpp>
@@ -10,6 +11,9 @@
 #include <cassert>
 #include <vector>
 
+struct BitStreamReader;
+struct BitStreamWriter;
+
 struct GridPoint {
     glm::ivec2 pos;
 
@@ -67,8 +71,10 @@ struct Map {
         return point(p.x, p.y);
     }
 
+    // The heights at (x, y) only depend on the generator's seed,
+    // so chunks of the map can be generated independently
     static Map generate(size_t sizeX, size_t sizeY,
-                        size_t heightLimit, size_t seed);
+                        size_t heightLimit, const Random &);
 
     template<typename F>
     void forNeighbors(const Pos &p, F f) {
@@ -104,6 +110,9 @@ struct Map {
     void tick(fixed tickLengthS);
 
 private:
+    friend void read(BitStreamReader &, Map &);
+    friend void write(BitStreamWriter &, const Map &);
+
     size_t sizeX;
     size_t sizeY;
 
@@ -112,4 +121,8 @@ private:
     std::vector<GridPoint> points; // 2d array
 };
 
+// NOTE: Reading requires the map to already have the stored size
+void read(BitStreamReader &, Map &);
+void write(BitStreamWriter &, const Map &);
+
 #endif
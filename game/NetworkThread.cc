@@ -0,0 +1,293 @@
+#include "NetworkThread.hh"
+#include "common/BitStream.hh"
+#include "util/Log.hh"
+
+#include <algorithm>
+#include <stdexcept>
+#include <iostream>
+#include <cassert>
+
+// Upper bound for how long a queued message waits before it is sent
+static const enet_uint32 SERVICE_TIMEOUT_MS = 1;
+
+// Commands only hold an encoded packet. Events hold a whole Message, which
+// stores its short lists inline and takes about three kilobytes, so their
+// queue is sized by memory instead.
+static const size_t COMMAND_QUEUE_CAPACITY = 256;
+static const size_t EVENT_QUEUE_BYTES = 256 * 1024;
+
+// SpscQueue rounds its capacity up to a power of two, so round down here
+// to stay within the budget
+static size_t eventQueueCapacity(size_t eventSize) {
+    size_t capacity = 16;
+    while (capacity * 2 * eventSize <= EVENT_QUEUE_BYTES)
+        capacity *= 2;
+    return capacity;
+}
+
+static uint64_t microsecondsSince(NetworkThread::Clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        NetworkThread::Clock::now() - time).count();
+}
+
+NetworkThread::NetworkThread()
+    : host(NULL),
+      peer(NULL),
+      commands(COMMAND_QUEUE_CAPACITY),
+      events(eventQueueCapacity(sizeof(Event))),
+      quit(false),
+      numSent(0),
+      sendDelaySumUs(0),
+      sendDelayMaxUs(0),
+      numReceived(0),
+      receiveDelaySumUs(0),
+      receiveDelayMaxUs(0) {
+}
+
+NetworkThread::~NetworkThread() {
+    if (thread.joinable()) {
+        quit = true;
+        thread.join();
+    }
+
+    Command command;
+    while (commands.pop(command))
+        if (command.packet)
+            enet_packet_destroy(command.packet);
+    for (auto &command : commandBacklog)
+        if (command.packet)
+            enet_packet_destroy(command.packet);
+
+    if (host)
+        enet_host_destroy(host);
+}
+
+void NetworkThread::connect(const std::string &hostName, int port) {
+    assert(!host);
+
+    host = enet_host_create(NULL, 1, NUM_CHANNELS, 0, 0);
+
+    if (host == NULL)
+        throw std::runtime_error("Failed to create ENet client");
+
+    enet_address_set_host(&serverAddress, hostName.c_str());
+    serverAddress.port = port;
+
+    peer = enet_host_connect(host, &serverAddress, NUM_CHANNELS,
+                             PROTOCOL_FINGERPRINT);
+    if (peer == NULL)
+        throw std::runtime_error("Failed to connect");
+
+    ENetEvent event;
+    if (enet_host_service(host, &event, 5000) > 0 &&
+        event.type == ENET_EVENT_TYPE_CONNECT) {
+        std::cout << "Connected!" << std::endl;
+    } else {
+        enet_peer_reset(peer);
+
+        throw std::runtime_error("Failed to connect");
+    }
+
+    // From now on, only the thread touches the host
+    thread = std::thread(&NetworkThread::run, this);
+}
+
+void NetworkThread::send(const Message &message, enet_uint8 channel) {
+    Command command;
+    command.type = Command::SEND;
+    command.packet = message.toPacket();
+    command.channel = channel;
+    command.messageType = message.type;
+    command.time = Clock::now();
+
+    issue(command);
+}
+
+void NetworkThread::reconnect() {
+    Command command;
+    command.type = Command::RECONNECT;
+    command.packet = NULL;
+    command.channel = 0;
+    command.messageType = Message::UNDEFINED;
+    command.time = Clock::now();
+
+    issue(command);
+}
+
+void NetworkThread::issue(const Command &command) {
+    // Commands must not overtake the ones that are still waiting
+    while (!commandBacklog.empty() && commands.push(commandBacklog.front()))
+        commandBacklog.pop_front();
+
+    if (!commandBacklog.empty() || !commands.push(command))
+        commandBacklog.push_back(command);
+}
+
+bool NetworkThread::poll(Event &event) {
+    // Retry sending what did not fit into the queue before
+    while (!commandBacklog.empty() && commands.push(commandBacklog.front()))
+        commandBacklog.pop_front();
+
+    if (!events.pop(event))
+        return false;
+
+    if (event.type == Event::RECEIVED) {
+        uint64_t delayUs = microsecondsSince(event.time);
+
+        numReceived++;
+        receiveDelaySumUs += delayUs;
+        receiveDelayMaxUs = std::max(receiveDelayMaxUs, delayUs);
+    }
+
+    return true;
+}
+
+void NetworkThread::dumpStats() {
+    uint64_t sent = numSent.exchange(0);
+    uint64_t sendSumUs = sendDelaySumUs.exchange(0);
+    uint64_t sendMaxUs = sendDelayMaxUs.exchange(0);
+
+    INFO(network) << sent << " messages sent, queued for "
+                  << (sent ? sendSumUs / sent : 0) << "us on average, "
+                  << sendMaxUs << "us max; "
+                  << numReceived << " received, queued for "
+                  << (numReceived ? receiveDelaySumUs / numReceived : 0)
+                  << "us on average, " << receiveDelayMaxUs << "us max";
+
+    numReceived = 0;
+    receiveDelaySumUs = 0;
+    receiveDelayMaxUs = 0;
+}
+
+PeerStats NetworkThread::takeStats() {
+    std::lock_guard<std::mutex> lock(statsMutex);
+
+    PeerStats taken = stats;
+    stats = PeerStats();
+    return taken;
+}
+
+void NetworkThread::run() {
+    while (!quit) {
+        executeCommands();
+
+        ENetEvent event;
+        int result = enet_host_service(host, &event, SERVICE_TIMEOUT_MS);
+        while (result > 0) {
+            handleEvent(event);
+            result = enet_host_service(host, &event, 0);
+        }
+
+        // Retry passing on what did not fit into the queue before
+        while (!eventBacklog.empty() && events.push(eventBacklog.front()))
+            eventBacklog.pop_front();
+    }
+}
+
+void NetworkThread::executeCommands() {
+    bool sent = false;
+
+    Command command;
+    while (commands.pop(command)) {
+        switch (command.type) {
+        case Command::SEND: {
+            uint64_t delayUs = microsecondsSince(command.time);
+
+            numSent++;
+            sendDelaySumUs += delayUs;
+            // The main thread may reset the maximum in between
+            uint64_t maxUs = sendDelayMaxUs.load();
+            while (delayUs > maxUs &&
+                   !sendDelayMaxUs.compare_exchange_weak(maxUs, delayUs)) {
+                // maxUs has been updated to the current value
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(statsMutex);
+                stats.sent.add(command.messageType,
+                               command.packet->dataLength);
+            }
+
+            // Fails while we are not connected
+            if (!peer ||
+                enet_peer_send(peer, command.channel, command.packet) < 0)
+                enet_packet_destroy(command.packet);
+            sent = true;
+            break;
+        }
+        case Command::RECONNECT:
+            peer = enet_host_connect(host, &serverAddress, NUM_CHANNELS,
+                                     PROTOCOL_FINGERPRINT);
+
+            // Without a free peer, ENet would never report back, so we
+            // report the failed attempt ourselves
+            if (!peer) {
+                Event event;
+                event.type = Event::DISCONNECTED;
+                event.channel = 0;
+                event.time = Clock::now();
+                emit(event);
+            }
+            break;
+        default: assert(false);
+        }
+    }
+
+    // Do not wait for the next service call, acks are urgent
+    if (sent)
+        enet_host_flush(host);
+}
+
+void NetworkThread::handleEvent(const ENetEvent &enetEvent) {
+    Event event;
+    event.channel = 0;
+    event.time = Clock::now();
+
+    switch (enetEvent.type) {
+    case ENET_EVENT_TYPE_CONNECT:
+        event.type = Event::CONNECTED;
+        break;
+    case ENET_EVENT_TYPE_RECEIVE: {
+        BitStreamReader reader(enetEvent.packet->data,
+                               enetEvent.packet->dataLength);
+
+        event.type = Event::RECEIVED;
+        event.channel = enetEvent.channelID;
+        read(reader, event.message);
+
+        // Hang up on a server that sends garbage; we hear about it
+        // again as a disconnect
+        if (reader.hasFailed()) {
+            std::cout << "Received a malformed packet, disconnecting"
+                      << std::endl;
+            enet_peer_disconnect(enetEvent.peer, 0);
+            enet_packet_destroy(enetEvent.packet);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(statsMutex);
+            stats.received.add(event.message.type,
+                               enetEvent.packet->dataLength);
+
+            // Ticks arrive at a steady rate, as on the server
+            if (event.message.type == Message::SERVER_TICK)
+                stats.sampleRtt(enetEvent.peer);
+        }
+
+        enet_packet_destroy(enetEvent.packet);
+        break;
+    }
+    case ENET_EVENT_TYPE_DISCONNECT:
+        event.type = Event::DISCONNECTED;
+        break;
+    default: assert(false);
+    }
+
+    emit(event);
+}
+
+void NetworkThread::emit(const Event &event) {
+    if (!eventBacklog.empty() || !events.push(event))
+        eventBacklog.push_back(event);
+}
@@ -0,0 +1,132 @@
+#ifndef STRAT_GAME_NETWORK_THREAD_HH
+#define STRAT_GAME_NETWORK_THREAD_HH
+
+#include "common/Message.hh"
+#include "common/NetStats.hh"
+#include "util/SpscQueue.hh"
+
+#include <enet/enet.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Services the client's ENet host on a thread of its own, so that a slow
+// frame delays neither receiving ticks nor acknowledging them, which would
+// hold back every player of the match.
+//
+// The thread decodes incoming packets and passes the messages by value to
+// the main loop through a lock-free queue, so that the usual messages need
+// no allocations. Outgoing messages are encoded by the caller and go the
+// other way through a second queue; the thread sends them as soon as it
+// wakes up, which is at least every millisecond.
+//
+// Everything except the queues and the stats belongs to one of the two
+// threads. If a queue is full, the producer keeps the items in a backlog
+// of its own and retries later, so nothing is lost.
+struct NetworkThread {
+    typedef std::chrono::steady_clock Clock;
+
+    struct Event {
+        enum Type {
+            CONNECTED,
+            DISCONNECTED,
+            RECEIVED
+        };
+
+        Type type;
+
+        // Only for RECEIVED events
+        Message message;
+        enet_uint8 channel;
+
+        // When the network thread got the event
+        Clock::time_point time;
+    };
+
+    NetworkThread();
+    ~NetworkThread();
+
+    NetworkThread(const NetworkThread &) = delete;
+    NetworkThread &operator=(const NetworkThread &) = delete;
+
+    // Connects to the server and then starts the thread.
+    // Throws if the connection fails.
+    void connect(const std::string &host, int port);
+
+    void send(const Message &, enet_uint8 channel);
+
+    // Starts a new connection attempt after a DISCONNECTED event
+    void reconnect();
+
+    // Returns false if there are no more events for now
+    bool poll(Event &);
+
+    // Logs how long messages waited in the queues and resets the counters
+    void dumpStats();
+
+    // Returns the traffic and RTT since the last call. The tick lag and
+    // lead are up to the caller, who knows which ticks it has executed.
+    PeerStats takeStats();
+
+private:
+    // Commands from the main loop
+    struct Command {
+        enum Type {
+            SEND,
+            RECONNECT
+        };
+
+        Type type;
+
+        ENetPacket *packet;
+        enet_uint8 channel;
+        Message::Type messageType;
+
+        // When the main loop issued the command
+        Clock::time_point time;
+    };
+
+    ENetHost *host;
+    ENetPeer *peer;
+    ENetAddress serverAddress;
+
+    SpscQueue<Command> commands;
+    SpscQueue<Event> events;
+
+    // Items that did not fit into the queues. commandBacklog belongs to
+    // the main loop, eventBacklog to the network thread.
+    std::deque<Command> commandBacklog;
+    std::deque<Event> eventBacklog;
+
+    std::thread thread;
+    std::atomic<bool> quit;
+
+    // Written by the network thread
+    std::atomic<uint64_t> numSent;
+    std::atomic<uint64_t> sendDelaySumUs;
+    std::atomic<uint64_t> sendDelayMaxUs;
+
+    // Written by the main loop
+    uint64_t numReceived;
+    uint64_t receiveDelaySumUs;
+    uint64_t receiveDelayMaxUs;
+
+    // Written by the network thread, once per packet. The lock is only
+    // ever contended while the main loop takes the stats.
+    std::mutex statsMutex;
+    PeerStats stats;
+
+    void issue(const Command &);
+
+    void run();
+    void executeCommands();
+    void handleEvent(const ENetEvent &);
+    void emit(const Event &);
+};
+
+#endif
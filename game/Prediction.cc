@@ -0,0 +1,136 @@
+#include "Prediction.hh"
+
+#include "util/Log.hh"
+#include "util/Profiling.hh"
+
+#include <algorithm>
+#include <chrono>
+
+Prediction::Stats::Stats()
+    : ticks(0),
+      rollbacks(0),
+      resimulatedTicks(0),
+      expiredOrders(0),
+      resimulationS(0) {
+}
+
+Prediction::Prediction(const GameSettings &settings, const Sim &authoritative,
+                       PlayerId player, size_t lead, size_t window)
+    : authoritative(authoritative),
+      sim(settings),
+      player(player),
+      lead(std::min(std::max<size_t>(lead, 1), window)),
+      window(window),
+      tick(0),
+      confirmedSeq(0),
+      predictedSeq(0) {
+    assert(window > 0);
+
+    rollback();
+}
+
+void Prediction::setLead(size_t newLead) {
+    newLead = std::min(std::max<size_t>(newLead, 1), window);
+    if (newLead == lead)
+        return;
+
+    lead = newLead;
+    rollback();
+}
+
+void Prediction::addOrder(const Order &order) {
+    assert(order.player == player);
+    assert(order.seq > predictedSeq);
+
+    PendingOrder pendingOrder = { order, tick };
+    pending.push_back(pendingOrder);
+
+    // Make the order visible right away
+    rollback();
+}
+
+void Prediction::confirmTick(const std::vector<Order> &orders) {
+    PROFILE(prediction);
+
+    tick++;
+    stats.ticks++;
+
+    bool otherOrders = false;
+    for (auto &order : orders) {
+        if (order.player == player)
+            confirmedSeq = std::max(confirmedSeq, order.seq);
+        else
+            otherOrders = true;
+    }
+
+    // The server executes our orders in the sequence we sent them,
+    // so everything up to confirmedSeq is done with
+    auto confirmed = std::find_if(pending.begin(), pending.end(),
+        [&](const PendingOrder &p) { return p.order.seq > confirmedSeq; });
+    pending.erase(pending.begin(), confirmed);
+
+    // Give up on orders that the server seems to have lost
+    auto expired = std::find_if(pending.begin(), pending.end(),
+        [&](const PendingOrder &p) { return tick - p.tick <= window; });
+    stats.expiredOrders += expired - pending.begin();
+    pending.erase(pending.begin(), expired);
+
+    // We predicted that the tick contains exactly our orders up to
+    // predictedSeq. If that was right, our predicted state is still valid
+    // and only needs to be advanced by one tick to keep the lead.
+    if (!otherOrders && confirmedSeq == predictedSeq && pending.empty()) {
+        nextOrders.clear();
+        simulate(1);
+    } else {
+        rollback();
+    }
+}
+
+void Prediction::reset() {
+    stats.expiredOrders += pending.size();
+    pending.clear();
+
+    confirmedSeq = predictedSeq;
+
+    rollback();
+}
+
+void Prediction::dumpStats() {
+    INFO(prediction) << stats.ticks << " ticks, "
+                     << stats.rollbacks << " rollbacks, "
+                     << stats.resimulatedTicks << " resimulated ticks, "
+                     << "lead " << lead << " ticks, "
+                     << stats.expiredOrders << " expired orders, "
+                     << (stats.rollbacks > 0 ?
+                         stats.resimulationS * 1000.0 / stats.rollbacks : 0.0)
+                     << "ms/rollback";
+
+    stats = Stats();
+}
+
+void Prediction::rollback() {
+    PROFILE(rollback);
+
+    sim.copyFrom(authoritative);
+
+    nextOrders.clear();
+    for (auto &p : pending)
+        nextOrders.push_back(p.order);
+
+    predictedSeq = pending.empty() ? confirmedSeq : pending.back().order.seq;
+
+    stats.rollbacks++;
+    stats.resimulatedTicks += lead;
+
+    auto start = std::chrono::steady_clock::now();
+    simulate(lead);
+    stats.resimulationS += std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+void Prediction::simulate(size_t numTicks) {
+    for (size_t i = 0; i < numTicks; i++) {
+        sim.runTick(nextOrders);
+        nextOrders.clear();
+    }
+}
@@ -0,0 +1,92 @@
+#ifndef STRAT_GAME_PREDICTION_HH
+#define STRAT_GAME_PREDICTION_HH
+
+#include "Sim.hh"
+#include "common/GameSettings.hh"
+#include "common/Order.hh"
+
+#include <vector>
+#include <cstddef>
+
+// Prediction executes the local player's orders speculatively,
+// so that they become visible without waiting for the server.
+//
+// We keep a second simulation which runs `lead' ticks ahead of
+// the authoritative one, which should match the input delay: that is how
+// many ticks later the server executes an order we send now. All orders of
+// the local player that have not yet come back from the server are assumed
+// to be executed in the next tick.
+//
+// Whenever the authoritative simulation runs a tick that differs from
+// what we predicted, the predicted simulation is rolled back to the
+// authoritative state and all `lead' ticks are simulated again.
+// Orders that the server has not confirmed within `window' ticks
+// are given up on.
+struct Prediction {
+    struct Stats {
+        size_t ticks;          // authoritative ticks seen
+        size_t rollbacks;
+        size_t resimulatedTicks;
+        size_t expiredOrders;
+        double resimulationS;  // time spent simulating predicted ticks
+
+        Stats();
+    };
+
+    Prediction(const GameSettings &, const Sim &authoritative,
+               PlayerId, size_t lead = 2, size_t window = 8);
+
+    // Moves the prediction to `lead' ticks ahead, clamped to [1, window],
+    // e.g. when the input delay changes
+    void setLead(size_t);
+
+    // Call with each order the local player sends to the server
+    void addOrder(const Order &);
+
+    // Call after the authoritative simulation has run a tick with `orders'
+    void confirmTick(const std::vector<Order> &orders);
+
+    // Call after the authoritative simulation has been replaced, e.g. by a
+    // snapshot. Our orders that have not come back are given up on.
+    void reset();
+
+    Sim &getSim() { return sim; }
+    const Sim &getSim() const { return sim; }
+
+    const Stats &getStats() const { return stats; }
+
+    // Logs the stats and resets them
+    void dumpStats();
+
+private:
+    struct PendingOrder {
+        Order order;
+        size_t tick; // authoritative tick at which the order was issued
+    };
+
+    const Sim &authoritative;
+    Sim sim;
+
+    PlayerId player;
+
+    size_t lead;
+    size_t window;
+
+    size_t tick;
+
+    std::vector<PendingOrder> pending;
+    std::vector<Order> nextOrders;
+
+    // Highest sequence number of our orders that the server has executed
+    uint32_t confirmedSeq;
+
+    // Highest sequence number included in the predicted ticks
+    uint32_t predictedSeq;
+
+    Stats stats;
+
+    void rollback();
+    void simulate(size_t numTicks);
+};
+
+#endif
@@ -0,0 +1,57 @@
+#include "ReplayPlayer.hh"
+
+#include "common/BitStream.hh"
+#include "util/Profiling.hh"
+
+ReplayPlayer::ReplayPlayer(ReplayReader &reader)
+    : reader(reader),
+      sim(reader.getSettings()),
+      tick(0) {
+    // The initial state is stored as well, if the recorder had a simulation
+    if (reader.readKeyframe(0, keyframe)) {
+        BitStreamReader stream(keyframe);
+        sim.load(stream);
+    }
+}
+
+bool ReplayPlayer::step() {
+    if (!reader.readTick(tick + 1, orders))
+        return false;
+
+    sim.runTick(orders);
+    tick++;
+
+    return true;
+}
+
+bool ReplayPlayer::seek(size_t targetTick) {
+    PROFILE(seek);
+
+    if (targetTick > reader.getNumTicks())
+        return false;
+
+    // Only load a keyframe if we would otherwise need to go back in time
+    // or it saves us some ticks
+    size_t keyframeTick;
+    if (reader.findKeyframe(targetTick, keyframeTick) &&
+        (keyframeTick > tick || targetTick < tick)) {
+        if (!reader.readKeyframe(keyframeTick, keyframe))
+            return false;
+
+        BitStreamReader stream(keyframe);
+        sim.load(stream);
+        tick = keyframeTick;
+    } else if (targetTick < tick) {
+        // No keyframe to go back to, so start over from the beginning
+        Sim initial(reader.getSettings());
+        sim.copyFrom(initial);
+        tick = 0;
+    }
+
+    while (tick < targetTick) {
+        if (!step())
+            return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,40 @@
+#ifndef STRAT_GAME_REPLAY_PLAYER_HH
+#define STRAT_GAME_REPLAY_PLAYER_HH
+
+#include "Sim.hh"
+#include "common/Replay.hh"
+
+#include <vector>
+
+// Simulates a recorded match.
+//
+// Seeking restores the latest keyframe before the target tick
+// and then runs the remaining ticks as fast as possible. Without
+// such a keyframe, it starts over from the initial state.
+struct ReplayPlayer {
+    // The reader needs to stay alive as long as the player
+    ReplayPlayer(ReplayReader &);
+
+    Sim &getSim() { return sim; }
+    const Sim &getSim() const { return sim; }
+
+    // Number of ticks that have been executed
+    size_t getTick() const { return tick; }
+
+    // Executes the next tick, returns false at the end of the replay
+    bool step();
+
+    // Brings the simulation to the state after executing `targetTick'
+    bool seek(size_t targetTick);
+
+private:
+    ReplayReader &reader;
+    Sim sim;
+
+    size_t tick;
+
+    std::vector<Order> orders;
+    std::vector<uint8_t> keyframe;
+};
+
+#endif
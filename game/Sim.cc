@@ -19,6 +19,24 @@ void Sim::runTick(const std::vector<Order> &orders) {
 
 }
 
+void Sim::copyFrom(const Sim &other) {
+    PROFILE(copy);
+
+    state.copyFrom(other.state);
+}
+
+void Sim::save(BitStreamWriter &writer) const {
+    PROFILE(save);
+
+    write(writer, state);
+}
+
+void Sim::load(BitStreamReader &reader) {
+    PROFILE(load);
+
+    read(reader, state);
+}
+
 const SimState &Sim::getState() const {
     return state;
 }
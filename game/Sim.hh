@@ -28,6 +28,15 @@ struct Sim {
 
     void runTick(const std::vector<Order> &orders);
 
+    // Resets this simulation to the state of another one.
+    // Both need to have been created from the same settings.
+    void copyFrom(const Sim &);
+
+    // Serializes the complete simulation state, e.g. for replays.
+    // Loading requires a simulation created from the same settings.
+    void save(BitStreamWriter &) const;
+    void load(BitStreamReader &);
+
     const SimState &getState() const;
 
     entityx::EntityManager &getEntities() {
@@ -0,0 +1,56 @@
+#include "SimBatch.hh"
+
+#include <cassert>
+#include <chrono>
+
+SimBatch::SimBatch(ThreadPool &pool, const std::vector<GameSettings> &settings,
+                   OrderSource orderSource)
+    : pool(pool),
+      orderSource(orderSource),
+      matches(settings.size()),
+      tick(0),
+      threadOrders(pool.getNumThreads()) {
+    pool.run(matches.size(), [&] (size_t match, size_t) {
+        matches[match].sim.reset(new Sim(settings[match]));
+        matches[match].simulationS = 0;
+    });
+}
+
+void SimBatch::run(size_t numTicks) {
+    // Every task runs all ticks of one match, so that the threads only
+    // need to synchronize once per call
+    pool.run(matches.size(), [&] (size_t index, size_t thread) {
+        Match &match = matches[index];
+        std::vector<Order> &orders = threadOrders[thread];
+
+        auto startTime = std::chrono::steady_clock::now();
+
+        for (size_t i = 1; i <= numTicks; i++) {
+            orders.clear();
+            if (orderSource)
+                orderSource(index, tick + i, orders);
+
+            match.sim->runTick(orders);
+        }
+
+        match.simulationS += std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - startTime).count();
+    });
+
+    tick += numTicks;
+}
+
+const Sim &SimBatch::getSim(size_t match) const {
+    assert(match < matches.size());
+    return *matches[match].sim;
+}
+
+SimBatch::Result SimBatch::getResult(size_t match) const {
+    assert(match < matches.size());
+
+    Result result;
+    result.ticks = tick;
+    result.simulationS = matches[match].simulationS;
+    result.hash = matches[match].sim->getState().hash();
+    return result;
+}
@@ -0,0 +1,63 @@
+#ifndef STRAT_GAME_SIM_BATCH_HH
+#define STRAT_GAME_SIM_BATCH_HH
+
+#include "Sim.hh"
+#include "common/GameSettings.hh"
+#include "common/Order.hh"
+#include "util/ThreadPool.hh"
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+// Runs many independent matches at once, e.g. for bot tuning.
+//
+// The matches are distributed over the threads of a pool. Every match
+// is only touched by one thread at a time, and the simulation has no
+// global state, so the matches do not need any synchronization.
+// All matches are advanced in lock-step: after run() returns,
+// every match has executed the same number of ticks.
+struct SimBatch {
+    // Fills in the orders for tick `tick' of match `match'.
+    // Called concurrently for different matches.
+    typedef std::function<void(size_t match, size_t tick,
+                               std::vector<Order> &orders)> OrderSource;
+
+    struct Result {
+        size_t ticks;
+        double simulationS; // time spent in this match's ticks
+        uint64_t hash;      // SimState::hash() of the current state
+    };
+
+    // Creates one match per settings entry; the maps are generated
+    // in parallel
+    SimBatch(ThreadPool &, const std::vector<GameSettings> &, OrderSource);
+
+    size_t getNumMatches() const { return matches.size(); }
+
+    // Number of ticks that every match has executed
+    size_t getTick() const { return tick; }
+
+    // Advances every match by `numTicks' ticks
+    void run(size_t numTicks);
+
+    const Sim &getSim(size_t match) const;
+    Result getResult(size_t match) const;
+
+private:
+    struct Match {
+        std::unique_ptr<Sim> sim;
+        double simulationS;
+    };
+
+    ThreadPool &pool;
+    OrderSource orderSource;
+
+    std::vector<Match> matches;
+    size_t tick;
+
+    // Order buffer for every worker thread, reused for all its matches
+    std::vector<std::vector<Order>> threadOrders;
+};
+
+#endif
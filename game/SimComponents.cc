@@ -1,5 +1,6 @@
 #include "game/SimComponents.hh"
 #include "util/Math.hh"
+#include "common/BitStream.hh"
 
 void PhysicsState::recalculate() {
     velocity = momentum / mass;
@@ -49,3 +50,37 @@ PhysicsState PhysicsState::interpolate(const PhysicsState &a, const PhysicsState
 
     return r;
 }
+
+void read(BitStreamReader &reader, PhysicsState &state) {
+    read(reader, state.size);
+    read(reader, state.mass);
+    read(reader, state.inertia);
+    read(reader, state.position);
+    read(reader, state.momentum);
+    read(reader, state.velocity);
+    read(reader, state.orientation);
+    read(reader, state.angularMomentum);
+    read(reader, state.spin);
+    read(reader, state.angularVelocity);
+}
+
+void write(BitStreamWriter &writer, const PhysicsState &state) {
+    write(writer, state.size);
+    write(writer, state.mass);
+    write(writer, state.inertia);
+    write(writer, state.position);
+    write(writer, state.momentum);
+    write(writer, state.velocity);
+    write(writer, state.orientation);
+    write(writer, state.angularMomentum);
+    write(writer, state.spin);
+    write(writer, state.angularVelocity);
+}
+
+void read(BitStreamReader &reader, Ship &ship) {
+    read(reader, ship.rudder);
+}
+
+void write(BitStreamWriter &writer, const Ship &ship) {
+    write(writer, ship.rudder);
+}
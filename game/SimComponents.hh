@@ -9,6 +9,9 @@
 
 using entityx::Entity;
 
+struct BitStreamReader;
+struct BitStreamWriter;
+
 struct GameObject : entityx::Component<GameObject> {
     GameObject(PlayerId owner, ObjectId id)
         : owner(owner),
@@ -68,4 +71,12 @@ struct Ship : entityx::Component<Ship> {
     fixed rudder;
 };
 
+// Serialization of components, used for storing the complete simulation state
+
+void read(BitStreamReader &, PhysicsState &);
+void write(BitStreamWriter &, const PhysicsState &);
+
+void read(BitStreamReader &, Ship &);
+void write(BitStreamWriter &, const Ship &);
+
 #endif
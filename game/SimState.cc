@@ -2,8 +2,14 @@
 
 #include "SimComponents.hh"
 #include "util/Profiling.hh"
+#include "common/BitStream.hh"
 
 #include <cstdlib>
+#include <cstring>
+
+// Fleets start out in a grid next to the first ship
+static const size_t FLEET_COLUMNS = 10;
+static const size_t FLEET_SPACING = 4;
 
 PlayerState::PlayerState(const PlayerInfo &info)
     : info(info) {
@@ -11,14 +17,21 @@ PlayerState::PlayerState(const PlayerInfo &info)
 
 SimState::SimState(const GameSettings &settings)
     : settings(settings),
+      random(settings.randomSeed),
       map(settings.mapW, settings.mapH),
       water(map),
       players(playersFromSettings(settings)),
       entityCounter(0),
       time(0) {
     for (auto &player : settings.players) {
-        size_t x = rand() % settings.mapW, y = rand() % settings.mapH;
-        getPlayer(player.id).ship = addShip(player.id, fvec2(fixed(x), fixed(y)));
+        size_t x = random.nextBelow(settings.mapW),
+               y = random.nextBelow(settings.mapH);
+
+        for (size_t i = 0; i < settings.fleetSize; i++) {
+            size_t shipX = (x + (i % FLEET_COLUMNS) * FLEET_SPACING) % settings.mapW,
+                   shipY = (y + (i / FLEET_COLUMNS) * FLEET_SPACING) % settings.mapH;
+            addShip(player.id, fvec2(fixed(shipX), fixed(shipY)));
+        }
     }
 
     /*for (size_t i = 0; i < 10; i++) {
@@ -38,25 +51,91 @@ SimState::SimState(const GameSettings &settings)
     }*/
 }
 
+void SimState::copyFrom(const SimState &other) {
+    assert(&settings == &other.settings ||
+           (settings.mapW == other.settings.mapW &&
+            settings.mapH == other.settings.mapH));
+
+    random = other.random;
+
+    map = other.map;
+    water.copyFrom(other.water);
+
+    entityCounter = other.entityCounter;
+    time = other.time;
+
+    // Recreate all the game objects. Resetting the EntityManager makes sure
+    // that the new entities get the same relative order as in `other'.
+    entities.reset();
+
+    auto otherEntities = const_cast<entityx::EntityManager *>(&other.entities);
+
+    std::map<ObjectId, Entity> objects;
+
+    GameObject::Handle gameObject;
+    for (auto otherEntity : otherEntities->entities_with_components(gameObject)) {
+        Entity entity = entities.create();
+        entity.assign<GameObject>(*gameObject.get());
+        objects[gameObject->getId()] = entity;
+
+        if (auto physicsState = otherEntity.component<PhysicsState>())
+            entity.assign<PhysicsState>(*physicsState.get());
+        if (auto previousPhysicsState = otherEntity.component<PreviousPhysicsState>())
+            entity.assign<PreviousPhysicsState>(*previousPhysicsState.get());
+        if (auto ship = otherEntity.component<Ship>())
+            entity.assign<Ship>(*ship.get());
+    }
+
+    for (auto &player : other.players) {
+        std::vector<Entity> &units = getPlayer(player.first).units;
+        units.clear();
+
+        for (auto unit : player.second.units)
+            units.push_back(objects[unit.component<GameObject>()->getId()]);
+    }
+}
+
 bool SimState::isOrderValid(const Order &order) const {
-    if (players.find(order.player) == players.end())
+    auto player = players.find(order.player);
+    if (player == players.end() ||
+        !order.units.isValid(player->second.units.size()))
         return false;
 
     switch (order.type) {
         case Order::ACCELERATE:
-            return true;
+            return order.accelerate.count > 0;
 
         default:
             return false;
     }
 }
 
+// Calls `f' for every unit of `player' that `units' refers to
+template<typename F>
+static void forEachUnit(const PlayerState &player, const UnitSet &units, F f) {
+    if (units.empty()) {
+        if (!player.units.empty())
+            f(player.units[0]);
+        return;
+    }
+
+    for (auto &range : units.ranges) {
+        for (size_t i = range.first; i < range.first + range.count; i++)
+            f(player.units[i]);
+    }
+}
+
 void SimState::runOrder(const Order &order) {
     assert(isOrderValid(order));
 
     switch (order.type) {
         case Order::ACCELERATE: {
-            shipSystem.accelerate(*this, order.player, order.accelerate.direction);
+            // Applied one by one, so that merged orders have exactly the
+            // same effect as separate ones
+            forEachUnit(getPlayer(order.player), order.units, [&](Entity ship) {
+                for (size_t i = 0; i < order.accelerate.count; i++)
+                    shipSystem.accelerate(ship, order.accelerate.direction);
+            });
 
             /*size_t x1 = rand() % settings.mapW, y1 = rand() % settings.mapH;
             size_t x2 = rand() % settings.mapW, y2 = rand() % settings.mapH;
@@ -117,6 +196,10 @@ entityx::Entity SimState::addShip(PlayerId owner, const fvec2 &position) {
     entity.assign<PhysicsState>(fvec3(3,1,1), fixed(100), fixed(500), fvec3(position, fixed(100)));
     entity.assign<Ship>();
 
+    auto player = players.find(owner);
+    if (player != players.end())
+        player->second.units.push_back(entity);
+
     return entity;
 }
 
@@ -137,12 +220,94 @@ void SimState::tick() {
 
     {
         PROFILE(objects);
-        copyPhysicsStateSystem.tick(*this);
-        physicsSystem.tick(*this, tickLengthS);
-        shipSystem.tick(*this, tickLengthS);
+
+        {
+            PROFILE(copy_physics_state);
+            copyPhysicsStateSystem.tick(*this);
+        }
+        {
+            PROFILE(physics);
+            physicsSystem.tick(*this, tickLengthS);
+        }
+        {
+            PROFILE(ship);
+            shipSystem.tick(*this, tickLengthS);
+        }
     }
 } 
 
+// FNV-1a
+static void hashBytes(uint64_t &h, const void *data, size_t size) {
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < size; i++) {
+        h ^= bytes[i];
+        h *= 1099511628211ULL;
+    }
+}
+
+static void hashFixed(uint64_t &h, fixed f) {
+    int32_t raw;
+    static_assert(sizeof(raw) == sizeof(f), "Unexpected fixed size");
+    memcpy(&raw, &f, sizeof(raw));
+    hashBytes(h, &raw, sizeof(raw));
+}
+
+static void hashFixed(uint64_t &h, const fvec3 &v) {
+    hashFixed(h, v.x);
+    hashFixed(h, v.y);
+    hashFixed(h, v.z);
+}
+
+static void hashFixed(uint64_t &h, const fquat &q) {
+    hashFixed(h, q.w);
+    hashFixed(h, q.x);
+    hashFixed(h, q.y);
+    hashFixed(h, q.z);
+}
+
+uint64_t SimState::hash() const {
+    uint64_t h = 14695981039346656037ULL;
+
+    hashFixed(h, time);
+
+    uint64_t counter = entityCounter;
+    hashBytes(h, &counter, sizeof(counter));
+
+    uint64_t randomCounter = random.getCounter();
+    hashBytes(h, &randomCounter, sizeof(randomCounter));
+
+    for (size_t y = 0; y < map.getSizeY(); y++) {
+        for (size_t x = 0; x < map.getSizeX(); x++) {
+            uint64_t height = map.point(x, y).height;
+            hashBytes(h, &height, sizeof(height));
+
+            const WaterPoint &waterPoint(water.point(x, y));
+            hashFixed(h, waterPoint.height);
+            hashFixed(h, waterPoint.velocity);
+            hashFixed(h, waterPoint.acceleration);
+        }
+    }
+
+    auto ents = const_cast<entityx::EntityManager *>(&entities);
+
+    GameObject::Handle gameObject;
+    for (auto entity : ents->entities_with_components(gameObject)) {
+        PlayerId owner = gameObject->getOwner();
+        ObjectId id = gameObject->getId();
+        hashBytes(h, &owner, sizeof(owner));
+        hashBytes(h, &id, sizeof(id));
+
+        if (auto physicsState = entity.component<PhysicsState>()) {
+            hashFixed(h, physicsState->position);
+            hashFixed(h, physicsState->momentum);
+            hashFixed(h, physicsState->orientation);
+            hashFixed(h, physicsState->angularMomentum);
+        }
+    }
+
+    return h;
+}
+
 SimState::PlayerMap SimState::playersFromSettings(const GameSettings &settings) {
     SimState::PlayerMap players;
 
@@ -152,3 +317,151 @@ SimState::PlayerMap SimState::playersFromSettings(const GameSettings &settings)
 
     return players;
 }
+
+// Snapshots come from other clients, so anything in them that would break
+// our state fails the reader. The state is then left empty but consistent,
+// to be replaced by the next snapshot.
+void read(BitStreamReader &reader, SimState &state) {
+    read(reader, state.time);
+
+    uint32_t entityCounter;
+    read(reader, entityCounter);
+    state.entityCounter = entityCounter;
+
+    uint64_t randomCounter;
+    read(reader, randomCounter);
+    state.random.setCounter(randomCounter);
+
+    read(reader, state.map);
+    read(reader, state.water);
+
+    // Recreate game objects in the stored order, see SimState::copyFrom
+    state.entities.reset();
+
+    for (auto &player : state.players)
+        player.second.units.clear();
+
+    // Each object takes at least its owner, id and components
+    const size_t minObjectBits = (sizeof(PlayerId) + sizeof(ObjectId) + 1) * 8;
+
+    uint32_t numObjects;
+    read(reader, numObjects);
+    if (numObjects > reader.bitsLeft() / minObjectBits)
+        reader.fail();
+
+    std::map<ObjectId, Entity> objects;
+
+    for (size_t i = 0; i < numObjects && !reader.hasFailed(); i++) {
+        PlayerId owner;
+        ObjectId id;
+        read(reader, owner);
+        read(reader, id);
+
+        Entity entity = state.entities.create();
+        entity.assign<GameObject>(owner, id);
+        objects[id] = entity;
+
+        uint8_t components;
+        read(reader, components);
+
+        if (components & 1) {
+            PhysicsState physicsState;
+            read(reader, physicsState);
+            entity.assign<PhysicsState>(physicsState);
+        }
+        if (components & 2) {
+            auto previousPhysicsState = entity.assign<PreviousPhysicsState>();
+            read(reader, previousPhysicsState->state);
+        }
+        if (components & 4) {
+            Ship ship;
+            read(reader, ship);
+            entity.assign<Ship>(ship);
+        }
+    }
+
+    for (size_t i = 0; i < state.players.size() && !reader.hasFailed(); i++) {
+        PlayerId player;
+        uint32_t numUnits;
+        read(reader, player);
+        read(reader, numUnits);
+
+        auto position = state.players.find(player);
+        if (position == state.players.end() ||
+            numUnits > reader.bitsLeft() / (sizeof(ObjectId) * 8)) {
+            reader.fail();
+            break;
+        }
+
+        std::vector<Entity> &units = position->second.units;
+        units.clear();
+
+        for (size_t j = 0; j < numUnits; j++) {
+            ObjectId unit;
+            read(reader, unit);
+
+            auto object = objects.find(unit);
+            if (object == objects.end()) {
+                reader.fail();
+                break;
+            }
+            units.push_back(object->second);
+        }
+    }
+
+    if (reader.hasFailed()) {
+        state.entities.reset();
+
+        for (auto &player : state.players)
+            player.second.units.clear();
+    }
+}
+
+void write(BitStreamWriter &writer, const SimState &state) {
+    write(writer, state.time);
+    write(writer, static_cast<uint32_t>(state.entityCounter));
+    write(writer, state.random.getCounter());
+
+    write(writer, state.map);
+    write(writer, state.water);
+
+    auto ents = const_cast<entityx::EntityManager *>(&state.entities);
+
+    GameObject::Handle gameObject;
+
+    uint32_t numObjects = 0;
+    for (auto entity : ents->entities_with_components(gameObject)) {
+        (void)entity;
+        numObjects++;
+    }
+    write(writer, numObjects);
+
+    for (auto entity : ents->entities_with_components(gameObject)) {
+        write(writer, gameObject->getOwner());
+        write(writer, gameObject->getId());
+
+        auto physicsState = entity.component<PhysicsState>();
+        auto previousPhysicsState = entity.component<PreviousPhysicsState>();
+        auto ship = entity.component<Ship>();
+
+        uint8_t components = (physicsState ? 1 : 0) |
+                             (previousPhysicsState ? 2 : 0) |
+                             (ship ? 4 : 0);
+        write(writer, components);
+
+        if (physicsState)
+            write(writer, *physicsState.get());
+        if (previousPhysicsState)
+            write(writer, previousPhysicsState->state);
+        if (ship)
+            write(writer, *ship.get());
+    }
+
+    for (auto &player : state.players) {
+        write(writer, player.first);
+        write(writer, static_cast<uint32_t>(player.second.units.size()));
+
+        for (auto unit : player.second.units)
+            write(writer, unit.component<GameObject>()->getId());
+    }
+}
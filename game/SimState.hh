@@ -5,18 +5,25 @@
 #include "Water.hh"
 #include "SimSystems.hh"
 #include "util/Fixed.hh"
+#include "util/Random.hh"
 #include "common/GameSettings.hh"
 #include "common/Order.hh"
 
 #include <entityx/entityx.h>
 #include <map>
+#include <vector>
 
 using entityx::Entity;
 
+struct BitStreamReader;
+struct BitStreamWriter;
+
 struct PlayerState {
     PlayerState(const PlayerInfo &info);
 
-    Entity ship;
+    // Ships of the player in the order they were created,
+    // which is how orders refer to them
+    std::vector<Entity> units;
 
 private:
     const PlayerInfo &info;
@@ -34,6 +41,11 @@ private:
 struct SimState : entityx::EntityX {
     SimState(const GameSettings &);
 
+    // Overwrites this state with a copy of another state that was
+    // created from the same settings. Entities are recreated in the
+    // same order, so that both states continue to evolve identically.
+    void copyFrom(const SimState &);
+
     bool isOrderValid(const Order &) const;
     void runOrder(const Order &);
     
@@ -43,6 +55,9 @@ struct SimState : entityx::EntityX {
     Water &getWater() { return water; }
     const Water &getWater() const { return water; }
 
+    // All randomness in the simulation needs to come from here
+    Random &getRandom() { return random; }
+
     PlayerState &getPlayer(PlayerId);
     const PlayerState &getPlayer(PlayerId) const;
 
@@ -54,15 +69,25 @@ struct SimState : entityx::EntityX {
     // Time elapsed in simulation in seconds
     fixed getTimeS() const { return time; }
 
+    // Also adds the ship to the units of `owner'
     Entity addShip(PlayerId owner, const fvec2 &position);
 
     void tick();
 
+    // Hash of the complete state, for comparing simulations
+    // that are supposed to run in sync
+    uint64_t hash() const;
+
 private:
+    friend void read(BitStreamReader &, SimState &);
+    friend void write(BitStreamWriter &, const SimState &);
+
     typedef std::map<PlayerId, PlayerState> PlayerMap;
 
     const GameSettings &settings;
 
+    Random random;
+
     Map map;
     Water water;
     
@@ -79,4 +104,9 @@ private:
     static PlayerMap playersFromSettings(const GameSettings &);
 };
 
+// Stores the complete state, so that it can be restored into a
+// SimState that was created from the same settings.
+void read(BitStreamReader &, SimState &);
+void write(BitStreamWriter &, const SimState &);
+
 #endif
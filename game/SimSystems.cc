@@ -134,8 +134,7 @@ void PhysicsSystem::tick(SimState &state, fixed tickLengthS) {
     }
 }
 
-void ShipSystem::accelerate(SimState &state, PlayerId player, Direction direction) {
-    Entity shipEntity(state.getPlayer(player).ship);
+void ShipSystem::accelerate(Entity shipEntity, Direction direction) {
     PhysicsState::Handle physicsState(shipEntity.component<PhysicsState>());
 
     fmat3 m(glm::mat3_cast(physicsState->orientation));
@@ -18,7 +18,7 @@ struct CopyPhysicsStateSystem {
 };
 
 struct ShipSystem {
-    void accelerate(SimState &, PlayerId, Direction);
+    void accelerate(entityx::Entity ship, Direction);
     void tick(SimState &, fixed tickLengthS);
 };
 
@@ -0,0 +1,140 @@
+#include "TickQueue.hh"
+
+#include "util/Log.hh"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+// Ticks beyond the target depth that we tolerate before catching up
+static const size_t CATCH_UP_MARGIN = 2;
+
+// Number of jitters (as in standard deviations) that the queue should cover
+static const double JITTER_FACTOR = 2.0;
+
+TickQueue::Stats::Stats()
+    : ticks(0),
+      underruns(0),
+      catchUps(0),
+      catchUpTicks(0),
+      maxDepth(0) {
+}
+
+TickQueue::TickQueue(const GameSettings &settings, size_t maxTargetDepth)
+    : settings(settings),
+      maxTargetDepth(maxTargetDepth),
+      slots(maxTargetDepth + CATCH_UP_MARGIN + 2),
+      first(0),
+      numTicks(0),
+      buffering(true),
+      catchingUp(false),
+      jitterS(0),
+      lastArrivalS(0),
+      haveArrival(false),
+      targetDepth(1),
+      depthLimit(maxTargetDepth) {
+    assert(maxTargetDepth >= 1);
+}
+
+void TickQueue::push(std::vector<Order> &orders, double timeS) {
+    // Only a burst beyond anything so far makes the ring grow
+    if (numTicks == slots.size()) {
+        std::vector<std::vector<Order>> grown(slots.size() * 2);
+        for (size_t i = 0; i < numTicks; i++)
+            grown[i].swap(slots[(first + i) % slots.size()]);
+
+        slots.swap(grown);
+        first = 0;
+    }
+
+    slots[(first + numTicks) % slots.size()].swap(orders);
+    orders.clear();
+    numTicks++;
+
+    stats.maxDepth = std::max(stats.maxDepth, numTicks);
+
+    // Ticks should arrive one tick length apart. The deviation is smoothed
+    // like the interarrival jitter of RTP (RFC 3550).
+    double tickLengthS = settings.tickLengthMs / 1000.0;
+
+    if (haveArrival) {
+        double deviationS = std::abs(timeS - lastArrivalS - tickLengthS);
+        jitterS += (deviationS - jitterS) / 16.0;
+    }
+
+    lastArrivalS = timeS;
+    haveArrival = true;
+
+    size_t depth = 1 + static_cast<size_t>(
+        std::ceil(JITTER_FACTOR * jitterS / tickLengthS));
+    targetDepth = std::min(depth, maxTargetDepth);
+}
+
+void TickQueue::setDepthLimit(size_t limit) {
+    depthLimit = std::max<size_t>(limit, 1);
+}
+
+void TickQueue::clear() {
+    for (size_t i = 0; i < numTicks; i++)
+        slots[(first + i) % slots.size()].clear();
+    first = 0;
+    numTicks = 0;
+
+    buffering = true;
+    catchingUp = false;
+    haveArrival = false;
+}
+
+bool TickQueue::pop(std::vector<Order> &orders, bool &catchUp) {
+    size_t depth = getTargetDepth();
+
+    if (numTicks == 0) {
+        if (!buffering)
+            stats.underruns++;
+
+        buffering = true;
+        return false;
+    }
+
+    if (buffering) {
+        if (numTicks < depth)
+            return false;
+
+        buffering = false;
+    }
+
+    if (!catchingUp && numTicks > depth + CATCH_UP_MARGIN) {
+        catchingUp = true;
+        stats.catchUps++;
+    }
+
+    // Leave exactly targetDepth ticks in the queue after catching up
+    if (catchingUp && numTicks <= depth + 1)
+        catchingUp = false;
+
+    catchUp = catchingUp;
+    if (catchUp)
+        stats.catchUpTicks++;
+
+    // The slot keeps the memory of the caller's previous tick
+    orders.swap(slots[first]);
+    slots[first].clear();
+    first = (first + 1) % slots.size();
+    numTicks--;
+
+    stats.ticks++;
+
+    return true;
+}
+
+void TickQueue::dumpStats() {
+    INFO(tickqueue) << stats.ticks << " ticks, "
+                    << "target depth " << getTargetDepth() << ", "
+                    << "jitter " << jitterS * 1000.0 << "ms, "
+                    << stats.underruns << " underruns, "
+                    << stats.catchUps << " catch-ups ("
+                    << stats.catchUpTicks << " ticks), "
+                    << "max depth " << stats.maxDepth;
+
+    stats = Stats();
+}
@@ -0,0 +1,88 @@
+#ifndef STRAT_GAME_TICK_QUEUE_HH
+#define STRAT_GAME_TICK_QUEUE_HH
+
+#include "common/GameSettings.hh"
+#include "common/Order.hh"
+
+#include <algorithm>
+#include <vector>
+#include <cstddef>
+
+// Jitter buffer for the ticks received from the server.
+//
+// Ticks do not arrive at a steady rate, so the client keeps a few of them
+// queued before playing them back. The target depth adapts to the measured
+// jitter of the arrival times: the more jitter, the more ticks are kept.
+//
+// If the queue runs empty, playback pauses until the target depth has been
+// reached again. If ticks pile up, e.g. after a burst, the client catches up
+// by executing the surplus ticks without interpolating between them.
+//
+// Ticks are stored in a ring of vectors that keep their memory, and pushing
+// and popping swaps vectors with the caller, so that once the ring and the
+// vectors are large enough, passing ticks through does not allocate.
+struct TickQueue {
+    struct Stats {
+        size_t ticks;
+        size_t underruns;    // playback had to wait for a tick
+        size_t catchUps;     // times we executed ticks back-to-back
+        size_t catchUpTicks; // ticks executed without interpolation
+        size_t maxDepth;
+
+        Stats();
+    };
+
+    TickQueue(const GameSettings &, size_t maxTargetDepth);
+
+    // Call with every newly received tick, `timeS' is the time of arrival.
+    // Leaves `orders' empty, but with memory for the next tick.
+    void push(std::vector<Order> &orders, double timeS);
+
+    // Removes the next tick to execute. `catchUp' is set if the tick should be
+    // executed right away, without interpolation. Returns false if playback
+    // should wait.
+    bool pop(std::vector<Order> &orders, bool &catchUp);
+
+    // The server starts at most this many ticks that we have not finished
+    // (see Message::ServerTick::inputDelay). Buffering for more than that
+    // would wait for a tick that never comes, so the target depth is capped.
+    void setDepthLimit(size_t);
+
+    // Drops all ticks and starts buffering again, keeping the stats
+    void clear();
+
+    size_t size() const { return numTicks; }
+
+    size_t getTargetDepth() const { return std::min(targetDepth, depthLimit); }
+    double getJitterS() const { return jitterS; }
+
+    const Stats &getStats() const { return stats; }
+
+    // Logs the stats and resets them
+    void dumpStats();
+
+private:
+    const GameSettings &settings;
+    size_t maxTargetDepth;
+
+    // The queued ticks are the `numTicks' slots from `first' on, wrapping
+    // around. The other slots are empty, but keep their memory.
+    std::vector<std::vector<Order>> slots;
+    size_t first;
+    size_t numTicks;
+
+    bool buffering;
+    bool catchingUp;
+
+    // Smoothed deviation of the arrival intervals from the tick length
+    double jitterS;
+    double lastArrivalS;
+    bool haveArrival;
+
+    size_t targetDepth;
+    size_t depthLimit;
+
+    Stats stats;
+};
+
+#endif
@@ -1,5 +1,7 @@
 #include "Water.hh"
 
+#include "common/BitStream.hh"
+
 Water::Water(const Map &map)
     : map(map),
       sizeX(map.getSizeX()), sizeY(map.getSizeY()),
@@ -13,6 +15,16 @@ Water::Water(const Map &map)
       spread(fixed(3) / fixed(4)) {
 }
 
+void Water::copyFrom(const Water &other) {
+    assert(sizeX == other.sizeX && sizeY == other.sizeY);
+
+    newBuffer = &points[other.newBuffer - other.points];
+    oldBuffer = &points[other.oldBuffer - other.points];
+
+    // Only the current buffer needs to be copied, since
+    // the other one is overwritten in every pass of Water::tick
+    *oldBuffer = *other.oldBuffer;
+}
 
 WaterPoint Water::fpoint(const fvec2 &p) const {
     assert(p.x >= 0 && p.x < sizeX);
@@ -114,3 +126,33 @@ void Water::propagate(fixed tickLengthS,
     newTo.acceleration += delta * tickLengthS;
     //newTo.height += delta * tickLengthS;
 }
+
+void read(BitStreamReader &reader, Water &water) {
+    uint32_t sizeX, sizeY;
+    read(reader, sizeX);
+    read(reader, sizeY);
+    if (sizeX != water.sizeX || sizeY != water.sizeY) {
+        reader.fail();
+        return;
+    }
+
+    // As in Water::copyFrom, only the current buffer is relevant
+    for (auto &point : *water.oldBuffer) {
+        read(reader, point.height);
+        read(reader, point.velocity);
+        read(reader, point.acceleration);
+        read(reader, point.previousHeight);
+    }
+}
+
+void write(BitStreamWriter &writer, const Water &water) {
+    write(writer, static_cast<uint32_t>(water.sizeX));
+    write(writer, static_cast<uint32_t>(water.sizeY));
+
+    for (auto &point : *water.oldBuffer) {
+        write(writer, point.height);
+        write(writer, point.velocity);
+        write(writer, point.acceleration);
+        write(writer, point.previousHeight);
+    }
+}
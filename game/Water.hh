@@ -7,6 +7,9 @@
 #include <cassert>
 #include <vector>
 
+struct BitStreamReader;
+struct BitStreamWriter;
+
 struct WaterPoint {
     fixed height, velocity;
     fixed acceleration; // acceleration that was applied in the last water tick
@@ -25,6 +28,9 @@ struct WaterPoint {
 struct Water {
     Water(const Map &);
 
+    // Copies the water state of another Water with the same size
+    void copyFrom(const Water &);
+
     size_t getSizeX() const { return sizeX; }
     size_t getSizeY() const { return sizeY; }
 
@@ -55,6 +61,9 @@ struct Water {
     void tick(fixed tickLengthS);
 
 private:
+    friend void read(BitStreamReader &, Water &);
+    friend void write(BitStreamWriter &, const Water &);
+
     void spring(fixed tickLengthS, WaterPoint &point);
     void propagate(fixed tickLengthS, 
                    size_t fromX, size_t fromY,
@@ -74,4 +83,8 @@ private:
     fixed spread;
 };
 
+// NOTE: Reading requires the water to already have the stored size
+void read(BitStreamReader &, Water &);
+void write(BitStreamWriter &, const Water &);
+
 #endif
@@ -59,6 +59,10 @@ public:
 
     fixed abs() const { return fixed(RAW, std::abs(g)); }
 
+    // The guts, e.g. for serialization
+    int toRaw() const { return g; }
+    static fixed fromRaw(int guts) { return fixed(RAW, guts); }
+
     //operator float() const { return toFloat(); } 
 
     static fixed fromFloat(float f) {
@@ -0,0 +1,953 @@
+#include "server/Match.hh"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <utility>
+
+#include "common/Replay.hh"
+
+// If we are waiting for a client for this long, the tick messages are sent
+// again, in case the client lost all of them
+static const std::chrono::milliseconds TICK_RESEND_INTERVAL(100);
+
+static const size_t DELAY_DECREASE_TICKS = 20;
+
+// The metrics report percentiles of this many tick intervals
+static const size_t METRICS_TICK_INTERVALS = 100;
+
+MatchConfig::MatchConfig()
+    : numPlayers(1),
+      tickRedundancy(3),
+      orderBudget(8),
+      orderOverflow(OVERFLOW_MERGE),
+      statsFile(NULL) {
+}
+
+Match::Match(size_t id, const MatchConfig &config, const GameSettings &settings)
+    : id(id),
+      config(config),
+      settings(settings),
+      gameStarted(false),
+      playerCounter(0),
+      tokenGenerator(std::random_device()()),
+      ticksStarted(0),
+      metricsTicks(0),
+      metricsTime(std::chrono::steady_clock::now()),
+      inputDelay(2),
+      ticksSinceDelayChange(0),
+      lateOrders(0),
+      droppedOrdersTotal(0),
+      mergedOrdersTotal(0),
+      clampedOrdersTotal(0),
+      snapshotSource(NULL),
+      scheduler(settings.tickLengthMs),
+      tickResends(0),
+      waitingForClients(false),
+      lastBlocker(NULL),
+      replay(NULL) {
+}
+
+Match::~Match() {
+    for (auto client : clients)
+        delete client;
+
+    delete replay;
+}
+
+ClientInfo *Match::addClient(ENetPeer *peer, bool relayed) {
+    assert(!gameStarted && !isFull());
+
+    ClientInfo *client = new ClientInfo(++playerCounter, peer, this);
+    client->player.color = playerCounter % 4;
+    client->player.team = playerCounter;
+    rejoinTokens[client->player.id] = tokenGenerator();
+
+    if (relayed) {
+        auto head = std::find_if(clients.begin(), clients.end(),
+            [&](ClientInfo *c) { return c->peer == peer; });
+        client->relayHead = head != clients.end() ? *head : client;
+    }
+
+    if (!client->relayHead || client->relayHead == client)
+        peer->data = client;
+    clients.push_back(client);
+
+    return client;
+}
+
+ClientInfo *Match::rejoinClient(ENetPeer *peer,
+                                const Message::ClientConnect &connect) {
+    if (!gameStarted)
+        return NULL;
+
+    auto player = std::find_if(settings.players.begin(), settings.players.end(),
+        [&](const PlayerInfo &p) { return p.id == connect.playerId; });
+    if (player == settings.players.end())
+        return NULL;
+
+    auto token = rejoinTokens.find(connect.playerId);
+    if (token == rejoinTokens.end() || token->second != connect.rejoinToken)
+        return NULL;
+
+    // We may not have noticed yet that the old connection is gone. Relays
+    // can not hand over their players, so those stay with them.
+    for (auto client : clients) {
+        if (client->player.id == connect.playerId) {
+            if (client->relayHead)
+                return NULL;
+
+            enet_peer_reset(client->peer);
+            removeClient(client);
+            break;
+        }
+    }
+
+    ClientInfo *client = new ClientInfo(player->id, peer, this);
+    client->player = *player;
+    client->player.name = connect.name;
+    client->state = ClientInfo::AWAITING_SNAPSHOT;
+    client->rejoinTime = std::chrono::steady_clock::now();
+
+    peer->data = client;
+    clients.push_back(client);
+
+    std::cout << "Match " << id << ": player " << client->player.id
+              << " rejoining" << std::endl;
+
+    Message connected(Message::SERVER_CONNECT);
+    connected.server_connect.yourPlayerId = client->player.id;
+    connected.server_connect.matchId = id;
+    connected.server_connect.rejoinToken = token->second;
+    sendMessage(client, connected);
+
+    // The snapshot and the ticks follow on the same channel
+    Message start(Message::SERVER_START);
+    start.server_start.settings = settings;
+    sendMessage(client, start, CHANNEL_BULK);
+
+    requestSnapshot();
+
+    return client;
+}
+
+void Match::removeClient(ClientInfo *client) {
+    if (client->relayHead == client) {
+        std::vector<ClientInfo *> seats;
+        for (auto other : clients) {
+            if (other != client && other->relayHead == client)
+                seats.push_back(other);
+        }
+
+        for (auto seat : seats)
+            removeClient(seat);
+    }
+
+    auto position = std::find(clients.begin(), clients.end(), client);
+    assert(position != clients.end());
+    clients.erase(position);
+
+    bool wasSnapshotSource = client == snapshotSource;
+    if (client == lastBlocker)
+        lastBlocker = NULL;
+    delete client;
+
+    if (wasSnapshotSource)
+        restartSnapshot();
+}
+
+void Match::sendMessage(ClientInfo *client, const Message &message,
+                        enet_uint8 channel) {
+    assert(client && client->peer);
+
+    ENetPacket *packet = message.toPacket();
+    client->stats.sent.add(message.type, packet->dataLength);
+    enet_peer_send(client->peer, channel, packet);
+}
+
+// Serializes the message once and sends the same packet to every client.
+// ENet reference counts packets, so the packet is freed once it has
+// been sent to all of them. A relay gets it only once, for all its seats.
+void Match::broadcast(const Message &message, enet_uint8 channel,
+                      enet_uint32 flags) {
+    ENetPacket *packet = message.toPacket(flags);
+
+    for (auto client : clients) {
+        assert(client->peer);
+        if (client->relayHead && client->relayHead != client)
+            continue;
+
+        client->stats.sent.add(message.type, packet->dataLength);
+        enet_peer_send(client->peer, channel, packet);
+    }
+
+    if (packet->referenceCount == 0)
+        enet_packet_destroy(packet);
+}
+
+// Adds the order to the orders of its tick, as far as the budget of
+// its player allows. The server decides alone and broadcasts the result,
+// so every client executes the same orders.
+void Match::scheduleOrder(ClientInfo *client, size_t index, const Order &order,
+                          std::chrono::steady_clock::time_point arrival) {
+    if (scheduledOrders.size() <= index) {
+        scheduledOrders.resize(index + 1);
+        scheduledArrivals.resize(index + 1);
+    }
+
+    std::vector<Order> &tickOrders = scheduledOrders[index];
+    std::vector<std::chrono::steady_clock::time_point> &arrivals =
+        scheduledArrivals[index];
+
+    size_t count = 0;
+    size_t last = 0;
+    for (size_t i = 0; i < tickOrders.size(); i++) {
+        if (tickOrders[i].player == order.player) {
+            count++;
+            last = i;
+        }
+    }
+
+    if (config.orderBudget == 0 || count < config.orderBudget) {
+        tickOrders.push_back(order);
+        arrivals.push_back(arrival);
+        return;
+    }
+
+    // The merged order stands for the latest one, see Order::merge
+    if (config.orderOverflow == MatchConfig::OVERFLOW_MERGE &&
+        count > 0 && tickOrders[last].canMerge(order)) {
+        tickOrders[last].merge(order);
+        arrivals[last] = arrival;
+        client->stats.mergedOrders++;
+        mergedOrdersTotal++;
+        return;
+    }
+
+    client->stats.droppedOrders++;
+    droppedOrdersTotal++;
+}
+
+// Keeps a single order from inflating the ticks of everyone, like the
+// budget does for the number of orders. Returns false if the order has
+// to be dropped, and sets `clamped' if it was cut down.
+static bool limitOrder(Order &order, bool &clamped) {
+    clamped = false;
+
+    if (order.units.ranges.size() > MAX_UNIT_RANGES)
+        return false;
+
+    if (order.type == Order::ACCELERATE &&
+        order.accelerate.count > MAX_MERGED_COUNT) {
+        order.accelerate.count = MAX_MERGED_COUNT;
+        clamped = true;
+    }
+
+    return true;
+}
+
+static void appendTick(Message::ServerTick &serverTick,
+                       const std::vector<Order> &orders) {
+    serverTick.ticks.resize(serverTick.ticks.size() + 1);
+    serverTick.ticks.back().assign(orders.begin(), orders.end());
+}
+
+// Broadcasts the latest ticks that not every client has completed yet,
+// at most `maxTicks' of them
+void Match::sendTicks(size_t maxTicks) {
+    assert(ticksStarted > 0 && !tickHistory.empty());
+
+    // Ticks that every client has completed need not be repeated.
+    // Rejoining clients get their ticks reliably.
+    size_t firstTick = ticksStarted;
+    for (auto client : clients) {
+        if (client->state == ClientInfo::PLAYING)
+            firstTick = std::min(firstTick, client->ticksDone + 1);
+    }
+
+    size_t historyStart = ticksStarted + 1 - tickHistory.size();
+    size_t numTicks = std::min(std::max<size_t>(1, maxTicks), tickHistory.size());
+    firstTick = std::max(firstTick, ticksStarted + 1 - numTicks);
+
+    Message message(Message::SERVER_TICK);
+    message.server_tick.tick = ticksStarted;
+    message.server_tick.inputDelay = inputDelay;
+    message.server_tick.holdUs.assign(newestHoldUs.begin(), newestHoldUs.end());
+
+    for (size_t tick = firstTick; tick <= ticksStarted; tick++)
+        appendTick(message.server_tick, tickHistory[tick - historyStart]);
+
+    broadcast(message, CHANNEL_TICKS, ENET_PACKET_FLAG_UNSEQUENCED);
+
+    lastTickSend = std::chrono::steady_clock::now();
+}
+
+void Match::startTick() {
+    assert(gameStarted);
+    for (auto client : clients) {
+        assert(client->ticksDone <= ticksStarted);
+        assert(client->state != ClientInfo::PLAYING ||
+               ticksStarted - client->ticksDone <= MAX_CLIENT_LAG);
+    }
+
+    auto now = std::chrono::steady_clock::now();
+
+    newestHoldUs.clear();
+    if (scheduledOrders.empty()) {
+        tickHistory.emplace_back();
+    } else {
+        tickHistory.push_back(std::move(scheduledOrders.front()));
+        scheduledOrders.pop_front();
+
+        for (auto arrival : scheduledArrivals.front()) {
+            newestHoldUs.push_back(static_cast<uint32_t>(
+                std::chrono::duration_cast<std::chrono::microseconds>(
+                    now - arrival).count()));
+        }
+        scheduledArrivals.pop_front();
+    }
+    if (!tickStartTimes.empty()) {
+        tickIntervalsMs.push_back(std::chrono::duration<double, std::milli>(
+            now - tickStartTimes.back()).count());
+
+        if (tickIntervalsMs.size() > METRICS_TICK_INTERVALS)
+            tickIntervalsMs.pop_front();
+    }
+    tickStartTimes.push_back(now);
+
+    ticksStarted++;
+
+    for (auto client : clients) {
+        if (client->state != ClientInfo::PLAYING)
+            continue;
+
+        client->stats.tickLag.add(ticksStarted - client->ticksDone);
+        client->stats.sampleRtt(client->peer);
+    }
+
+    // Keep the ticks after the snapshots of rejoining clients,
+    // until we have sent them
+    size_t keepAfter = ticksStarted;
+    for (auto client : clients) {
+        if (client->state == ClientInfo::AWAITING_SNAPSHOT ||
+            client->state == ClientInfo::RECEIVING_SNAPSHOT)
+            keepAfter = std::min(keepAfter, client->ticksDone);
+    }
+
+    while (tickHistory.size() > MAX_CLIENT_LAG + 1 &&
+           ticksStarted + 1 - tickHistory.size() <= keepAfter) {
+        tickHistory.pop_front();
+        tickStartTimes.pop_front();
+    }
+
+    if (replay)
+        replay->writeTick(ticksStarted, tickHistory.back());
+
+    sendTicks(config.tickRedundancy);
+
+    // Clients that are catching up must not miss any tick
+    Message message(Message::SERVER_TICK);
+    message.server_tick.tick = ticksStarted;
+    message.server_tick.inputDelay = inputDelay;
+    message.server_tick.holdUs.assign(newestHoldUs.begin(), newestHoldUs.end());
+
+    for (auto client : clients) {
+        if (client->state != ClientInfo::CATCHING_UP)
+            continue;
+
+        if (message.server_tick.ticks.empty())
+            appendTick(message.server_tick, tickHistory.back());
+
+        sendMessage(client, message, CHANNEL_BULK);
+    }
+}
+
+// Whether we can start another tick without getting more than
+// inputDelay ticks ahead of any client
+bool Match::prevTickDone() const {
+    assert(ticksStarted > 0);
+
+    bool done = true;
+    for (auto client : clients) {
+        assert(client->ticksDone <= ticksStarted);
+
+        if (client->state == ClientInfo::PLAYING)
+            done = done && (client->ticksDone + inputDelay > ticksStarted);
+    }
+
+    return done;
+}
+
+// Asks the client that is furthest ahead for a snapshot, if there are
+// clients waiting for one. The tick of the snapshot is not known until it
+// arrives, but it cannot be older than the last tick the client reported.
+// Relays have no simulation to take a snapshot of.
+void Match::requestSnapshot() {
+    if (snapshotSource)
+        return;
+
+    std::vector<ClientInfo *> waiting;
+    ClientInfo *source = NULL;
+
+    for (auto client : clients) {
+        if (client->state == ClientInfo::AWAITING_SNAPSHOT)
+            waiting.push_back(client);
+        else if (client->state == ClientInfo::PLAYING && !client->relayHead &&
+                 !client->snapshotFailed &&
+                 (!source || client->ticksDone > source->ticksDone))
+            source = client;
+    }
+
+    if (waiting.empty())
+        return;
+
+    if (!source) {
+        std::cout << "Match " << id << ": no client to get a snapshot from"
+                  << std::endl;
+
+        for (auto client : waiting)
+            enet_peer_disconnect(client->peer, 0);
+        return;
+    }
+
+    for (auto client : waiting)
+        client->ticksDone = source->ticksDone;
+
+    snapshotSource = source;
+    sendMessage(source, Message(Message::SERVER_SNAPSHOT_REQUEST));
+}
+
+// Asks someone else for the snapshot after the transfer broke off. The
+// rejoining clients start over; requestSnapshot() resets their ticksDone
+// to the new source, which keeps the ticks after it in the history.
+void Match::restartSnapshot() {
+    snapshotSource = NULL;
+
+    for (auto client : clients) {
+        if (client->state == ClientInfo::RECEIVING_SNAPSHOT)
+            client->state = ClientInfo::AWAITING_SNAPSHOT;
+    }
+
+    requestSnapshot();
+}
+
+// The tick of a chunk is the source's word. We must still have the ticks
+// after it to send, and all chunks of a transfer must agree on it.
+bool Match::isValidSnapshotChunk(const Message::SnapshotChunk &chunk) const {
+    size_t historyStart = ticksStarted + 1 - tickHistory.size();
+    if (chunk.tick > ticksStarted || chunk.tick + 1 < historyStart)
+        return false;
+
+    for (auto client : clients) {
+        if (client->state == ClientInfo::RECEIVING_SNAPSHOT &&
+            client->ticksDone != chunk.tick)
+            return false;
+
+        if (chunk.offset == 0 &&
+            client->state == ClientInfo::AWAITING_SNAPSHOT &&
+            chunk.tick < client->ticksDone)
+            return false;
+    }
+
+    return true;
+}
+
+void Match::forwardSnapshot(ClientInfo *source,
+                            const Message::SnapshotChunk &chunk) {
+    if (source != snapshotSource)
+        return;
+
+    if (!isValidSnapshotChunk(chunk)) {
+        std::cout << "Match " << id << ": invalid snapshot of tick "
+                  << chunk.tick << " from player " << source->player.id
+                  << std::endl;
+
+        source->snapshotFailed = true;
+        restartSnapshot();
+        return;
+    }
+
+    // Clients that started waiting during the transfer get the next snapshot
+    if (chunk.offset == 0) {
+        for (auto client : clients) {
+            if (client->state != ClientInfo::AWAITING_SNAPSHOT)
+                continue;
+
+            client->state = ClientInfo::RECEIVING_SNAPSHOT;
+            client->ticksDone = chunk.tick;
+            client->snapshotFrom = source->player.id;
+        }
+    }
+
+    Message message(Message::SERVER_SNAPSHOT);
+    message.snapshot_chunk = chunk;
+
+    for (auto client : clients) {
+        if (client->state == ClientInfo::RECEIVING_SNAPSHOT)
+            sendMessage(client, message, CHANNEL_BULK);
+    }
+
+    if (chunk.offset + chunk.data.size() < chunk.compressedSize)
+        return;
+
+    std::cout << "Match " << id << ": snapshot of tick " << chunk.tick
+              << ", " << chunk.compressedSize << " bytes ("
+              << chunk.size << " uncompressed)" << std::endl;
+
+    for (auto client : clients) {
+        if (client->state == ClientInfo::RECEIVING_SNAPSHOT)
+            sendBacklog(client);
+    }
+
+    snapshotSource = NULL;
+    requestSnapshot();
+}
+
+// The client could not load the snapshot it got. Its source is not asked
+// again, and the client waits for one from someone else.
+void Match::snapshotRejected(ClientInfo *client) {
+    if ((client->state != ClientInfo::RECEIVING_SNAPSHOT &&
+         client->state != ClientInfo::CATCHING_UP) ||
+        client->snapshotFrom == 0)
+        return;
+
+    std::cout << "Match " << id << ": player " << client->player.id
+              << " could not load the snapshot from player "
+              << client->snapshotFrom << std::endl;
+
+    for (auto other : clients) {
+        if (other->player.id == client->snapshotFrom && !other->relayHead)
+            other->snapshotFailed = true;
+    }
+
+    client->snapshotFrom = 0;
+    client->state = ClientInfo::AWAITING_SNAPSHOT;
+    requestSnapshot();
+}
+
+// Sends the ticks since the client's snapshot. From now on, the client
+// gets every tick reliably until it has caught up.
+void Match::sendBacklog(ClientInfo *client) {
+    client->state = ClientInfo::CATCHING_UP;
+
+    if (client->ticksDone == ticksStarted)
+        return;
+
+    size_t historyStart = ticksStarted + 1 - tickHistory.size();
+    assert(client->ticksDone + 1 >= historyStart);
+
+    Message message(Message::SERVER_TICK);
+    message.server_tick.tick = ticksStarted;
+    message.server_tick.inputDelay = inputDelay;
+    message.server_tick.holdUs.assign(newestHoldUs.begin(), newestHoldUs.end());
+
+    for (size_t tick = client->ticksDone + 1; tick <= ticksStarted; tick++)
+        appendTick(message.server_tick, tickHistory[tick - historyStart]);
+
+    sendMessage(client, message, CHANNEL_BULK);
+}
+
+// Adapts inputDelay to the latency of the worst client
+void Match::updateInputDelay() {
+    double worstMs = 0;
+    for (auto client : clients) {
+        if (client->state != ClientInfo::PLAYING ||
+            client->tickLatencySamples == 0)
+            continue;
+
+        // ENet's RTT variance also covers the time before the first acks
+        double deviationMs = std::max<double>(client->tickLatencyDevMs,
+                                              client->peer->roundTripTimeVariance);
+
+        worstMs = std::max(worstMs, client->tickLatencyMs + 2 * deviationMs);
+    }
+
+    if (worstMs == 0)
+        return;
+
+    size_t needed = static_cast<size_t>(std::ceil(worstMs / settings.tickLengthMs));
+    needed = std::min(std::max<size_t>(needed, 1), MAX_CLIENT_LAG);
+
+    ticksSinceDelayChange++;
+
+    if (needed > inputDelay ||
+        (needed < inputDelay && ticksSinceDelayChange >= DELAY_DECREASE_TICKS)) {
+        inputDelay = needed > inputDelay ? needed : inputDelay - 1;
+        ticksSinceDelayChange = 0;
+
+        std::cout << "Match " << id << ": input delay "
+                  << inputDelay << " ticks" << std::endl;
+    }
+}
+
+// Called when the tick we were waiting for can be started
+void Match::finishWait() {
+    assert(waitingForClients);
+
+    double waitMs = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - waitStart).count();
+
+    clientWaitMs.add(waitMs);
+    if (lastBlocker)
+        lastBlocker->stats.heldBackMs += waitMs;
+
+    waitingForClients = false;
+    lastBlocker = NULL;
+}
+
+void Match::dumpStats() {
+    // Matches run on several threads, so every line is built first
+    // and then printed at once
+    std::ostringstream out;
+    std::string prefix = "Match " + std::to_string(id) + ": ";
+
+    for (auto client : clients) {
+        out << prefix << "player " << client->player.id << ": "
+            << "tick latency " << client->tickLatencyMs << "ms "
+            << "(+-" << client->tickLatencyDevMs << "ms), "
+            << client->stats << "\n";
+    }
+
+    // Lateness that is not explained by waiting for clients is ours
+    out << prefix << "input delay " << inputDelay << " ticks, "
+        << lateOrders << " late orders, "
+        << tickResends << " tick resends, "
+        << "waited " << clientWaitMs.sum << "ms for clients ("
+        << clientWaitMs << "ms per tick)\n";
+    std::cout << out.str() << std::flush;
+
+    if (config.statsFile)
+        writeStats(*config.statsFile);
+
+    for (auto client : clients)
+        client->stats = PeerStats();
+
+    lateOrders = 0;
+    tickResends = 0;
+    clientWaitMs = Histogram();
+
+    scheduler.dumpStats(prefix);
+}
+
+void Match::writeStats(StatsFile &file) {
+    const TickScheduler::Stats &schedule = scheduler.getStats();
+
+    std::ostringstream out;
+    out << "{\"timeMs\":" << wallTimeMs()
+        << ",\"source\":\"server\",\"match\":" << id
+        << ",\"ticks\":" << schedule.ticks
+        << ",\"lateTicks\":" << schedule.lateTicks
+        << ",\"meanLatenessMs\":"
+        << (schedule.ticks > 0 ? schedule.totalLatenessMs / schedule.ticks : 0.0)
+        << ",\"maxLatenessMs\":" << schedule.maxLatenessMs
+        << ",\"inputDelay\":" << inputDelay
+        << ",\"lateOrders\":" << lateOrders
+        << ",\"tickResends\":" << tickResends
+        << ",\"clientWaitMs\":";
+    writeJson(out, clientWaitMs);
+
+    out << ",\"players\":[";
+    for (size_t i = 0; i < clients.size(); i++) {
+        out << (i > 0 ? "," : "")
+            << "{\"id\":" << clients[i]->player.id
+            << ",\"tickLatencyMs\":" << clients[i]->tickLatencyMs
+            << ",\"stats\":";
+        writeJson(out, clients[i]->stats);
+        out << "}";
+    }
+    out << "]}";
+
+    file.write(out.str());
+}
+
+void Match::collectMetrics(std::vector<MetricSample> &samples) {
+    std::string labels = "match=\"" + std::to_string(id) + "\"";
+
+    auto now = std::chrono::steady_clock::now();
+    double elapsedS = std::chrono::duration<double>(now - metricsTime).count();
+
+    addSample(samples, "strat_match_players", labels, clients.size());
+    addSample(samples, "strat_match_ticks_total", labels, ticksStarted);
+    addSample(samples, "strat_match_ticks_per_second", labels,
+              elapsedS > 0 ? (ticksStarted - metricsTicks) / elapsedS : 0.0);
+    addSample(samples, "strat_match_input_delay_ticks", labels, inputDelay);
+    addSample(samples, "strat_match_dropped_orders_total", labels,
+              droppedOrdersTotal);
+    addSample(samples, "strat_match_merged_orders_total", labels,
+              mergedOrdersTotal);
+    addSample(samples, "strat_match_clamped_orders_total", labels,
+              clampedOrdersTotal);
+
+    metricsTicks = ticksStarted;
+    metricsTime = now;
+
+    // The server does not simulate, so a tick lasts from its start
+    // until the next one is started
+    if (!tickIntervalsMs.empty()) {
+        std::vector<double> sorted(tickIntervalsMs.begin(),
+                                   tickIntervalsMs.end());
+        std::sort(sorted.begin(), sorted.end());
+
+        for (double quantile : {0.5, 0.9, 0.99, 1.0}) {
+            size_t index = static_cast<size_t>(
+                std::ceil(quantile * sorted.size())) - 1;
+
+            std::ostringstream quantileLabels;
+            quantileLabels << labels << ",quantile=\"" << quantile << "\"";
+            addSample(samples, "strat_match_tick_duration_ms",
+                      quantileLabels.str(), sorted[index]);
+        }
+    }
+
+    size_t numScheduled = 0;
+    for (auto &orders : scheduledOrders)
+        numScheduled += orders.size();
+    addSample(samples, "strat_match_scheduled_orders", labels, numScheduled);
+    addSample(samples, "strat_match_scheduled_ticks", labels,
+              scheduledOrders.size());
+
+    for (auto client : clients) {
+        std::string peerLabels = labels + ",player=\"" +
+                                 std::to_string(client->player.id) + "\"";
+
+        addSample(samples, "strat_peer_lag_ticks", peerLabels,
+                  ticksStarted - client->ticksDone);
+        addSample(samples, "strat_peer_rtt_ms", peerLabels,
+                  client->peer->roundTripTime);
+        addSample(samples, "strat_peer_tick_latency_ms", peerLabels,
+                  client->tickLatencyMs);
+        addSample(samples, "strat_peer_playing", peerLabels,
+                  client->state == ClientInfo::PLAYING);
+    }
+}
+
+void Match::start() {
+    std::cout << "Match " << id << ": all players connected; starting game"
+              << std::endl;
+
+    assert(!gameStarted);
+
+    // Store player infos in the GameSettings,
+    // and then broadcast it to the clients
+    assert(settings.players.empty());
+    for (auto client : clients)
+        settings.players.push_back(client->player);
+
+    Message message(Message::SERVER_START);
+    message.server_start.settings = settings;
+    broadcast(message);
+
+    gameStarted = true;
+
+    if (!config.replayFilename.empty()) {
+        std::string filename = config.replayFilename + "." + std::to_string(id);
+
+        std::cout << "Match " << id << ": recording replay to "
+                  << filename << std::endl;
+        replay = new ReplayWriter(filename, settings, 0);
+    }
+
+    for (size_t i = 0; i < inputDelay; i++)
+        startTick();
+    scheduler.start();
+}
+
+// The seat of a relay that plays `player', or NULL
+ClientInfo *Match::findRelaySeat(ClientInfo *head, PlayerId player) {
+    for (auto client : clients) {
+        if (client->relayHead == head && client->player.id == player)
+            return client;
+    }
+
+    return NULL;
+}
+
+// The client reports that it has executed its next tick
+void Match::tickDone(ClientInfo *client) {
+    // Rejoining clients start counting at their snapshot
+    if (client->state == ClientInfo::AWAITING_SNAPSHOT ||
+        client->state == ClientInfo::RECEIVING_SNAPSHOT)
+        return;
+
+    // Only a broken or malicious client finishes ticks we did not start
+    if (client->ticksDone >= ticksStarted)
+        return;
+
+    // Whether we might be waiting for this client
+    if (waitingForClients && client->state == ClientInfo::PLAYING &&
+        client->ticksDone + inputDelay <= ticksStarted)
+        lastBlocker = client;
+
+    client->ticksDone++;
+
+    if (client->state == ClientInfo::CATCHING_UP) {
+        if (client->ticksDone + inputDelay <= ticksStarted)
+            return;
+
+        client->state = ClientInfo::PLAYING;
+        client->snapshotFrom = 0;
+
+        std::cout << "Match " << id << ": player " << client->player.id
+                  << " caught up after "
+                  << std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() -
+                         client->rejoinTime).count()
+                  << "s" << std::endl;
+    }
+
+    size_t historyStart = ticksStarted + 1 - tickStartTimes.size();
+    if (client->ticksDone < historyStart)
+        return;
+
+    double sampleMs = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() -
+        tickStartTimes[client->ticksDone - historyStart]).count();
+
+    if (client->tickLatencySamples++ == 0) {
+        client->tickLatencyMs = sampleMs;
+        client->tickLatencyDevMs = sampleMs / 2;
+    } else {
+        double error = sampleMs - client->tickLatencyMs;
+        client->tickLatencyMs += error / 8;
+        client->tickLatencyDevMs += (std::abs(error) - client->tickLatencyDevMs) / 4;
+    }
+}
+
+void Match::handleMessage(ClientInfo *client, const Message &message) {
+    switch (message.type) {
+    case Message::CLIENT_CONNECT: {
+        client->player.name = message.client_connect.name;
+
+        Message message(Message::SERVER_CONNECT);
+        message.server_connect.yourPlayerId = client->player.id;
+        message.server_connect.matchId = id;
+        message.server_connect.rejoinToken = rejoinTokens[client->player.id];
+        sendMessage(client, message);
+        return;
+    }
+    case Message::CLIENT_ORDERS: {
+        if (!gameStarted) {
+            std::cout << "Match " << id << ": ignoring orders from player "
+                      << client->player.id << std::endl;
+            return;
+        }
+
+        auto arrival = std::chrono::steady_clock::now();
+
+        for (auto &order : message.client_orders.orders) {
+            // A relay sends the orders of all its seats, we only trust it
+            // to name one of them
+            ClientInfo *owner = client;
+            if (client->relayHead) {
+                owner = findRelaySeat(client, order.player);
+                if (!owner)
+                    continue;
+            }
+
+            Order scheduled(order);
+            bool clamped;
+            if (!limitOrder(scheduled, clamped)) {
+                owner->stats.droppedOrders++;
+                droppedOrdersTotal++;
+                continue;
+            }
+            if (clamped) {
+                owner->stats.clampedOrders++;
+                clampedOrdersTotal++;
+            }
+
+            // Orders for ticks that have already been started are moved to
+            // the next one. No client can be further ahead than us, so a
+            // tick beyond that must be bogus.
+            size_t tick = std::max<size_t>(order.tick, ticksStarted + 1);
+            tick = std::min(tick, ticksStarted + MAX_CLIENT_LAG);
+            tick = std::max(tick, owner->lastOrderTick);
+
+            if (order.tick <= ticksStarted)
+                lateOrders++;
+
+            owner->stats.tickLead.add(order.tick > ticksStarted ?
+                                      order.tick - ticksStarted : 0);
+
+            owner->lastOrderTick = tick;
+
+            scheduled.player = owner->player.id;
+            scheduled.tick = tick;
+            scheduleOrder(owner, tick - ticksStarted - 1, scheduled,
+                          arrival);
+        }
+
+        return;
+    }
+    case Message::CLIENT_TICK_DONE:
+        // A relay reports a tick once all its clients are done with it
+        if (client->relayHead) {
+            for (auto seat : clients) {
+                if (seat->relayHead == client)
+                    tickDone(seat);
+            }
+        } else {
+            tickDone(client);
+        }
+        return;
+
+    case Message::CLIENT_SNAPSHOT:
+        forwardSnapshot(client, message.snapshot_chunk);
+        return;
+
+    case Message::CLIENT_SNAPSHOT_FAILED:
+        snapshotRejected(client);
+        return;
+
+    default:
+        return;
+    }
+}
+
+uint32_t Match::update() {
+    if (!gameStarted || clients.empty())
+        return 1000;
+
+    // Print the scheduling stats about every ten seconds
+    const size_t statsInterval = std::max<size_t>(1, 10000 / settings.tickLengthMs);
+
+    // Clients that have not finished the previous tick hold back the
+    // next one; the delay shows up as lateness in the stats
+    if (scheduler.isDue() && prevTickDone()) {
+        if (waitingForClients)
+            finishWait();
+        else
+            clientWaitMs.add(0);
+
+        scheduler.tickStarted();
+        updateInputDelay();
+        startTick();
+
+        if (scheduler.getStats().ticks >= statsInterval)
+            dumpStats();
+    }
+
+    // Sleep until the next deadline, unless we are waiting for a client,
+    // in which case only a packet or a resend can make progress
+    if (scheduler.isDue() && !prevTickDone()) {
+        if (!waitingForClients) {
+            waitingForClients = true;
+            waitStart = std::chrono::steady_clock::now();
+        }
+
+        auto sinceSend = std::chrono::steady_clock::now() - lastTickSend;
+
+        if (sinceSend >= TICK_RESEND_INTERVAL) {
+            sendTicks(MAX_CLIENT_LAG + 1);
+            tickResends++;
+            sinceSend = std::chrono::steady_clock::duration::zero();
+        }
+
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            TICK_RESEND_INTERVAL - sinceSend).count() + 1;
+    }
+
+    return scheduler.getTimeoutMs();
+}
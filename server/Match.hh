@@ -0,0 +1,261 @@
+#ifndef STRAT_SERVER_MATCH_HH
+#define STRAT_SERVER_MATCH_HH
+
+#include <enet/enet.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "common/GameSettings.hh"
+#include "common/Message.hh"
+#include "common/NetStats.hh"
+#include "common/Order.hh"
+#include "server/Metrics.hh"
+#include "server/TickScheduler.hh"
+
+struct Match;
+struct ReplayWriter;
+
+struct ClientInfo {
+    // Clients that rejoin a running match first wait for a snapshot of the
+    // simulation, and then catch up on the ticks since the snapshot. They
+    // do not hold back the match until they are playing again.
+    enum State {
+        PLAYING,
+        AWAITING_SNAPSHOT,
+        RECEIVING_SNAPSHOT,
+        CATCHING_UP
+    };
+
+    ENetPeer *peer;
+    Match *match;
+
+    // Players behind a relay share its peer. This is the first seat of the
+    // relay, which gets the messages for all of them; NULL for players
+    // that are connected directly.
+    ClientInfo *relayHead;
+
+    State state;
+    std::chrono::steady_clock::time_point rejoinTime;
+
+    // Sent a snapshot we could not use, so we do not ask it again
+    bool snapshotFailed;
+
+    // For rejoining clients, the player whose snapshot they are getting
+    PlayerId snapshotFrom;
+
+    // For rejoining clients, the tick of their snapshot or a lower bound
+    size_t ticksDone;
+
+    // Time from starting a tick until the client reports it as done,
+    // smoothed like TCP's RTT estimate
+    double tickLatencyMs;
+    double tickLatencyDevMs;
+    size_t tickLatencySamples;
+
+    // The orders of a client are executed in the sequence it sent them
+    size_t lastOrderTick;
+
+    PlayerInfo player;
+
+    // Reset whenever the match prints its stats
+    PeerStats stats;
+
+    ClientInfo(PlayerId id, ENetPeer *peer, Match *match)
+        : peer(peer), match(match), relayHead(NULL), state(PLAYING),
+          snapshotFailed(false), snapshotFrom(0), ticksDone(0),
+          tickLatencyMs(0), tickLatencyDevMs(0), tickLatencySamples(0),
+          lastOrderTick(0), player() {
+        player.id = id;
+    }
+};
+
+// Settings shared by all matches of a server
+struct MatchConfig {
+    // What happens to an order beyond its player's budget for the tick
+    enum OrderOverflow {
+        OVERFLOW_DROP,  // it is dropped
+        OVERFLOW_MERGE  // it is merged into the player's last order of the
+                        // tick if possible (see Order::canMerge), else dropped
+    };
+
+    // The match starts once this many players have joined
+    size_t numPlayers;
+
+    // Maximum number of ticks per tick message
+    size_t tickRedundancy;
+
+    // Orders per player and tick, zero for no limit. Keeps a client that
+    // sends too many orders from inflating the ticks of everyone.
+    size_t orderBudget;
+    OrderOverflow orderOverflow;
+
+    // Replays are recorded to this file name plus the match id,
+    // unless it is empty
+    std::string replayFilename;
+
+    // Matches append their stats here if not NULL
+    StatsFile *statsFile;
+
+    MatchConfig();
+};
+
+// State of one running match: its players, the ticks that have been
+// started and the orders scheduled for the next ones.
+//
+// A match only talks to the ENet peers of its own clients, and all of its
+// methods are called from the thread of the shard that hosts it.
+struct Match {
+    Match(size_t id, const MatchConfig &, const GameSettings &);
+    ~Match();
+
+    Match(const Match &) = delete;
+    Match &operator=(const Match &) = delete;
+
+    size_t getId() const { return id; }
+
+    bool isFull() const { return clients.size() >= config.numPlayers; }
+    size_t freeSeats() const { return config.numPlayers - clients.size(); }
+    bool isStarted() const { return gameStarted; }
+    bool isEmpty() const { return clients.empty(); }
+
+    // Adds a player; only possible before the match has started. A relay
+    // adds a seat for each of its clients, all on the same peer.
+    ClientInfo *addClient(ENetPeer *, bool relayed = false);
+
+    // Lets a client take over a player of the running match, replacing the
+    // player's old connection if there still is one. Returns NULL if there
+    // is no such player, or if it is behind a relay.
+    ClientInfo *rejoinClient(ENetPeer *, const Message::ClientConnect &);
+
+    // Deletes `client', and all other seats if it is the head of a relay
+    void removeClient(ClientInfo *client);
+
+    void start();
+
+    void handleMessage(ClientInfo *, const Message &);
+
+    // Starts the next tick if it is due, and resends ticks to clients that
+    // seem to be stuck. Returns the milliseconds until the next call is
+    // needed, assuming no packets arrive in the meantime.
+    uint32_t update();
+
+    // Adds the samples of the match and its players
+    void collectMetrics(std::vector<MetricSample> &);
+
+private:
+    size_t id;
+    const MatchConfig &config;
+    GameSettings settings;
+
+    bool gameStarted;
+
+    PlayerId playerCounter;
+
+    // Secrets that rejoining players must present, kept out of the
+    // settings since those are sent to everyone
+    std::map<PlayerId, uint64_t> rejoinTokens;
+    std::mt19937_64 tokenGenerator;
+    std::vector<ClientInfo *> clients;
+
+    size_t ticksStarted;
+
+    // Orders of the ticks that have not been started yet, beginning with
+    // tick ticksStarted + 1
+    std::deque<std::vector<Order>> scheduledOrders;
+
+    // When the scheduled orders arrived, in the same layout
+    std::deque<std::vector<std::chrono::steady_clock::time_point>>
+        scheduledArrivals;
+
+    // How long the orders of the newest tick were held, see
+    // Message::ServerTick::holdUs
+    std::vector<uint32_t> newestHoldUs;
+
+    // Orders of the last ticks, oldest first. Tick messages are sent
+    // unreliably and repeat the ticks that clients may have missed, so we
+    // keep enough history to cover the slowest client. While clients are
+    // rejoining, we also keep all ticks since their snapshot.
+    std::deque<std::vector<Order>> tickHistory;
+    std::deque<std::chrono::steady_clock::time_point> tickStartTimes;
+
+    // Time between the starts of the last ticks, for the metrics
+    std::deque<double> tickIntervalsMs;
+
+    // For the ticks per second since the last collectMetrics()
+    size_t metricsTicks;
+    std::chrono::steady_clock::time_point metricsTime;
+
+    // Number of ticks we may run ahead of the slowest client. Clients
+    // request their orders for this many ticks after the tick they are
+    // executing, so that the orders arrive before we start the tick.
+    // Chosen from the worst client's latency: it grows as soon as a client
+    // falls behind, and shrinks one tick at a time once the latency improves.
+    size_t inputDelay;
+    size_t ticksSinceDelayChange;
+
+    // Orders that arrived after their tick had been started
+    size_t lateOrders;
+
+    // Orders over budget or limits since the start of the match
+    size_t droppedOrdersTotal;
+    size_t mergedOrdersTotal;
+    size_t clampedOrdersTotal;
+
+    // Client we asked for a snapshot for the rejoining clients, if any
+    ClientInfo *snapshotSource;
+
+    TickScheduler scheduler;
+
+    std::chrono::steady_clock::time_point lastTickSend;
+    size_t tickResends;
+
+    // Whether the next tick is due but a client has not finished the
+    // previous one yet, since when, and who reported last. That client
+    // is the one the match waited for.
+    bool waitingForClients;
+    std::chrono::steady_clock::time_point waitStart;
+    ClientInfo *lastBlocker;
+
+    // Time each tick waited for clients after its deadline
+    Histogram clientWaitMs;
+
+    // The server has no simulation, so its replays do not contain keyframes
+    ReplayWriter *replay;
+
+    void sendMessage(ClientInfo *, const Message &,
+                     enet_uint8 channel = CHANNEL_CONTROL);
+    void broadcast(const Message &,
+                   enet_uint8 channel = CHANNEL_CONTROL,
+                   enet_uint32 flags = ENET_PACKET_FLAG_RELIABLE);
+
+    void scheduleOrder(ClientInfo *, size_t index, const Order &,
+                       std::chrono::steady_clock::time_point arrival);
+
+    ClientInfo *findRelaySeat(ClientInfo *head, PlayerId);
+    void tickDone(ClientInfo *);
+
+    void sendTicks(size_t maxTicks);
+    void startTick();
+    bool prevTickDone() const;
+
+    void requestSnapshot();
+    void restartSnapshot();
+    bool isValidSnapshotChunk(const Message::SnapshotChunk &) const;
+    void forwardSnapshot(ClientInfo *source, const Message::SnapshotChunk &);
+    void snapshotRejected(ClientInfo *);
+    void sendBacklog(ClientInfo *);
+
+    void updateInputDelay();
+    void finishWait();
+    void dumpStats();
+    void writeStats(StatsFile &);
+};
+
+#endif
@@ -0,0 +1,190 @@
+#include "server/Metrics.hh"
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+#include <sstream>
+
+// Connections that do not complete a request in time are closed
+static const std::chrono::seconds REQUEST_TIMEOUT(5);
+
+static const size_t MAX_REQUEST_SIZE = 4096;
+
+void addSample(std::vector<MetricSample> &samples, const std::string &name,
+               const std::string &labels, double value) {
+    MetricSample sample;
+    sample.name = name;
+    sample.labels = labels;
+    sample.value = value;
+    samples.push_back(sample);
+}
+
+MetricsBoard::MetricsBoard(size_t numShards)
+    : shards(numShards) {
+}
+
+void MetricsBoard::publish(size_t shard, std::vector<MetricSample> &samples) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    assert(shard < shards.size());
+    shards[shard].swap(samples);
+}
+
+std::string MetricsBoard::render() const {
+    std::vector<MetricSample> all;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        for (auto &samples : shards)
+            all.insert(all.end(), samples.begin(), samples.end());
+    }
+
+    // The format wants all samples of a metric in one group
+    std::stable_sort(all.begin(), all.end(),
+        [](const MetricSample &a, const MetricSample &b) {
+            return a.name < b.name;
+        });
+
+    std::ostringstream out;
+    out.precision(15);
+
+    for (auto &sample : all) {
+        out << sample.name;
+        if (!sample.labels.empty())
+            out << "{" << sample.labels << "}";
+        out << " " << sample.value << "\n";
+    }
+
+    return out.str();
+}
+
+MetricsServer::MetricsServer(uint16_t port, const MetricsBoard &board)
+    : board(board),
+      listenSocket(ENET_SOCKET_NULL) {
+    ENetAddress address;
+    enet_address_set_host(&address, "127.0.0.1");
+    address.port = port;
+
+    ENetSocket socket = enet_socket_create(ENET_SOCKET_TYPE_STREAM);
+    if (socket == ENET_SOCKET_NULL) {
+        std::cerr << "Failed to create metrics socket" << std::endl;
+        return;
+    }
+
+    enet_socket_set_option(socket, ENET_SOCKOPT_REUSEADDR, 1);
+
+    if (enet_socket_bind(socket, &address) < 0 ||
+        enet_socket_listen(socket, 16) < 0 ||
+        enet_socket_set_option(socket, ENET_SOCKOPT_NONBLOCK, 1) < 0) {
+        std::cerr << "Failed to listen for metrics requests on port "
+                  << port << std::endl;
+        enet_socket_destroy(socket);
+        return;
+    }
+
+    listenSocket = socket;
+
+    std::cout << "Serving metrics on localhost:" << port << std::endl;
+}
+
+MetricsServer::~MetricsServer() {
+    for (auto &connection : connections)
+        enet_socket_destroy(connection.socket);
+
+    if (listenSocket != ENET_SOCKET_NULL)
+        enet_socket_destroy(listenSocket);
+}
+
+void MetricsServer::poll() {
+    assert(isOpen());
+
+    for (;;) {
+        ENetSocket socket = enet_socket_accept(listenSocket, NULL);
+        if (socket == ENET_SOCKET_NULL)
+            break;
+
+        // Accepted sockets do not inherit the option everywhere
+        enet_socket_set_option(socket, ENET_SOCKOPT_NONBLOCK, 1);
+
+        Connection connection;
+        connection.socket = socket;
+        connection.acceptTime = Clock::now();
+        connection.sent = 0;
+        connection.responding = false;
+        connections.push_back(connection);
+    }
+
+    for (size_t i = 0; i < connections.size(); ) {
+        if (serve(connections[i])) {
+            i++;
+            continue;
+        }
+
+        enet_socket_destroy(connections[i].socket);
+        connections[i] = connections.back();
+        connections.pop_back();
+    }
+}
+
+bool MetricsServer::serve(Connection &connection) {
+    if (Clock::now() - connection.acceptTime > REQUEST_TIMEOUT)
+        return false;
+
+    if (!connection.responding) {
+        char data[1024];
+        ENetBuffer buffer;
+        buffer.data = data;
+        buffer.dataLength = sizeof(data);
+
+        // Zero means either no data yet or a closed connection, which
+        // the timeout takes care of
+        int received = enet_socket_receive(connection.socket, NULL, &buffer, 1);
+        if (received < 0)
+            return false;
+
+        connection.request.append(data, received);
+        if (connection.request.size() > MAX_REQUEST_SIZE)
+            return false;
+
+        // HTTP requests end with an empty line
+        const std::string &request = connection.request;
+        bool http = request.compare(0, 4, "GET ") == 0;
+        bool complete = http ?
+            (request.find("\r\n\r\n") != std::string::npos ||
+             request.find("\n\n") != std::string::npos) :
+            request.find('\n') != std::string::npos;
+
+        if (!complete)
+            return true;
+
+        std::string body = board.render();
+
+        if (http) {
+            std::ostringstream header;
+            header << "HTTP/1.0 200 OK\r\n"
+                   << "Content-Type: text/plain; version=0.0.4\r\n"
+                   << "Content-Length: " << body.size() << "\r\n"
+                   << "Connection: close\r\n\r\n";
+            connection.response = header.str();
+        }
+
+        connection.response += body;
+        connection.responding = true;
+    }
+
+    while (connection.sent < connection.response.size()) {
+        ENetBuffer buffer;
+        buffer.data = &connection.response[connection.sent];
+        buffer.dataLength = connection.response.size() - connection.sent;
+
+        int sent = enet_socket_send(connection.socket, NULL, &buffer, 1);
+        if (sent < 0)
+            return false;
+        if (sent == 0)
+            return true; // the socket buffer is full, try again later
+
+        connection.sent += sent;
+    }
+
+    return false;
+}
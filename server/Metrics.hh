@@ -0,0 +1,91 @@
+#ifndef STRAT_SERVER_METRICS_HH
+#define STRAT_SERVER_METRICS_HH
+
+#include <enet/enet.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Metrics for monitoring a running server, in the plain-text format of
+// Prometheus: one sample per line, `name{labels} value'.
+//
+// Shards collect the samples of their matches about once per second and
+// publish them on a MetricsBoard. The first shard additionally runs a
+// MetricsServer on a local TCP port, which answers every request with the
+// latest samples of all shards. A scraper therefore sees data that is at
+// most a second old, and no shard ever waits for another.
+
+struct MetricSample {
+    std::string name;
+    std::string labels; // e.g. match="1",player="2", may be empty
+    double value;
+};
+
+void addSample(std::vector<MetricSample> &, const std::string &name,
+               const std::string &labels, double value);
+
+// Latest samples of every shard
+struct MetricsBoard {
+    explicit MetricsBoard(size_t numShards);
+
+    MetricsBoard(const MetricsBoard &) = delete;
+    MetricsBoard &operator=(const MetricsBoard &) = delete;
+
+    // Replaces the previous samples of the shard
+    void publish(size_t shard, std::vector<MetricSample> &samples);
+
+    // Samples of all shards, grouped by name
+    std::string render() const;
+
+private:
+    mutable std::mutex mutex;
+    std::vector<std::vector<MetricSample>> shards;
+};
+
+// Answers requests on a TCP socket bound to localhost. Everything happens
+// in poll(), which never blocks, so that it can be called from the event
+// loop of a shard.
+//
+// A request is a line of text, or an HTTP GET request. The response is the
+// rendered board, with an HTTP header if the request was one. The
+// connection is closed after the response.
+struct MetricsServer {
+    typedef std::chrono::steady_clock Clock;
+
+    MetricsServer(uint16_t port, const MetricsBoard &);
+    ~MetricsServer();
+
+    MetricsServer(const MetricsServer &) = delete;
+    MetricsServer &operator=(const MetricsServer &) = delete;
+
+    bool isOpen() const { return listenSocket != ENET_SOCKET_NULL; }
+
+    // Accepts new connections, reads requests and sends what the
+    // sockets take of the responses
+    void poll();
+
+private:
+    struct Connection {
+        ENetSocket socket;
+        Clock::time_point acceptTime;
+
+        std::string request;
+        std::string response;
+        size_t sent;
+        bool responding;
+    };
+
+    const MetricsBoard &board;
+
+    ENetSocket listenSocket;
+    std::vector<Connection> connections;
+
+    // Returns false once the connection is done with
+    bool serve(Connection &);
+};
+
+#endif
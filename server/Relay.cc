@@ -0,0 +1,431 @@
+#include "server/Relay.hh"
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+
+#include "common/BitStream.hh"
+
+// How often the relay prints its traffic
+static const std::chrono::seconds STATS_INTERVAL(10);
+
+Relay::Relay(ServerState &state, const std::string &upstreamHost,
+             uint16_t upstreamPort, uint16_t port, size_t maxPeers,
+             size_t seats)
+    : state(state),
+      seats(seats),
+      host(NULL),
+      forming(NULL),
+      packetsReceived(0),
+      bytesReceived(0),
+      packetsForwarded(0),
+      bytesForwarded(0),
+      lastStats(std::chrono::steady_clock::now()) {
+    assert(seats > 0);
+
+    if (enet_address_set_host(&upstreamAddress, upstreamHost.c_str()) != 0) {
+        std::cerr << "Failed to resolve " << upstreamHost << std::endl;
+        return;
+    }
+    upstreamAddress.port = upstreamPort;
+
+    ENetAddress address;
+    address.host = ENET_HOST_ANY;
+    address.port = port;
+
+    // The connections to the server come from the same host
+    host = enet_host_create(&address, maxPeers + maxPeers / seats + 1,
+                            NUM_CHANNELS, 0, 0);
+
+    if (host == NULL) {
+        std::cerr << "Failed to create relay host on port " << port
+                  << std::endl;
+        return;
+    }
+
+    std::cout << "Relay listening on port " << port << ", forwarding to "
+              << upstreamHost << ":" << upstreamPort << std::endl;
+}
+
+Relay::~Relay() {
+    while (!groups.empty())
+        finishGroup(groups.back());
+
+    if (forming) {
+        for (auto client : forming->clients)
+            delete client;
+        delete forming;
+    }
+
+    if (host)
+        enet_host_destroy(host);
+}
+
+void Relay::run() {
+    assert(host);
+
+    while (!state.isDone()) {
+        ENetEvent event;
+
+        // Wake up regularly to notice when we are done
+        int result = enet_host_service(host, &event, 100);
+        while (result > 0) {
+            handleEvent(event);
+            result = enet_host_service(host, &event, 0);
+        }
+
+        // Everything that arrived in this round goes out together
+        for (auto group : groups)
+            flushOrders(group);
+        enet_host_flush(host);
+
+        if (std::chrono::steady_clock::now() - lastStats >= STATS_INTERVAL)
+            dumpStats();
+    }
+}
+
+void Relay::handleEvent(const ENetEvent &event) {
+    Member *member = static_cast<Member *>(event.peer->data);
+
+    switch (event.type) {
+    case ENET_EVENT_TYPE_CONNECT:
+        // Only our connections to the server have their member already
+        if (member) {
+            Group *group = member->group;
+
+            Message message(Message::CLIENT_CONNECT);
+            message.client_connect.name = "relay";
+            for (auto client : group->clients)
+                message.client_connect.relayedNames.push_back(client->name);
+
+            enet_peer_send(event.peer, CHANNEL_CONTROL, message.toPacket());
+            break;
+        }
+
+        if (event.data != PROTOCOL_FINGERPRINT) {
+            std::cout << "Relay: rejecting peer with protocol " << event.data
+                      << ", ours is " << PROTOCOL_FINGERPRINT << std::endl;
+            enet_peer_disconnect(event.peer, PROTOCOL_FINGERPRINT);
+        }
+        break;
+
+    case ENET_EVENT_TYPE_RECEIVE: {
+        if (member && member == &member->group->upstream) {
+            handleUpstream(member->group, event);
+            break;
+        }
+
+        BitStreamReader reader(event.packet->data, event.packet->dataLength);
+
+        Message message;
+        read(reader, message);
+
+        if (reader.hasFailed()) {
+            std::cout << "Relay: dropping peer that sent a malformed packet"
+                      << std::endl;
+            enet_peer_disconnect(event.peer, 0);
+        } else if (member)
+            handleClient(member, message);
+        else
+            joinGroup(event.peer, message);
+
+        enet_packet_destroy(event.packet);
+        break;
+    }
+    case ENET_EVENT_TYPE_DISCONNECT:
+        if (!member)
+            break;
+
+        if (member == &member->group->upstream) {
+            Group *group = member->group;
+            if (std::any_of(group->clients.begin(), group->clients.end(),
+                            [](Member *m) { return m->peer != NULL; }))
+                std::cout << "Relay: lost the connection to the server"
+                          << std::endl;
+
+            finishGroup(group);
+        } else {
+            leaveGroup(member);
+        }
+        break;
+
+    default: assert(false);
+    }
+}
+
+// Sends the packets of the server on as they are. ENet reference counts
+// packets, so all clients share the one we received.
+void Relay::handleUpstream(Group *group, const ENetEvent &event) {
+    ENetPacket *packet = event.packet;
+
+    BitStreamReader reader(packet->data, packet->dataLength);
+
+    Message message;
+    read(reader, message);
+
+    if (reader.hasFailed()) {
+        std::cout << "Relay: the server sent a malformed packet" << std::endl;
+        enet_peer_disconnect(event.peer, 0);
+        enet_packet_destroy(packet);
+        return;
+    }
+
+    packetsReceived++;
+    bytesReceived += packet->dataLength;
+
+    packet->flags = event.channelID == CHANNEL_TICKS ?
+        ENET_PACKET_FLAG_UNSEQUENCED : ENET_PACKET_FLAG_RELIABLE;
+
+    if (message.type == Message::SERVER_CONNECT) {
+        // The answers come in the order of the seats
+        if (group->connectsAnswered < group->clients.size()) {
+            Member *client = group->clients[group->connectsAnswered++];
+            client->player = message.server_connect.yourPlayerId;
+            group->matchId = message.server_connect.matchId;
+
+            if (client->peer) {
+                enet_peer_send(client->peer, event.channelID, packet);
+                packetsForwarded++;
+                bytesForwarded += packet->dataLength;
+            }
+        }
+    } else if (message.type != Message::SERVER_SNAPSHOT_REQUEST) {
+        for (auto client : group->clients) {
+            if (!client->peer)
+                continue;
+
+            enet_peer_send(client->peer, event.channelID, packet);
+            packetsForwarded++;
+            bytesForwarded += packet->dataLength;
+        }
+    }
+
+    if (message.type == Message::SERVER_TICK)
+        group->ticksReceived = std::max<size_t>(group->ticksReceived,
+                                                message.server_tick.tick);
+
+    if (message.type == Message::SERVER_START) {
+        std::cout << "Relay: match " << group->matchId << " started with "
+                  << group->clients.size() << " of our players" << std::endl;
+    }
+
+    if (packet->referenceCount == 0)
+        enet_packet_destroy(packet);
+}
+
+void Relay::handleClient(Member *client, const Message &message) {
+    Group *group = client->group;
+
+    switch (message.type) {
+    case Message::CLIENT_ORDERS:
+        if (client->player == 0)
+            return;
+
+        // The server checks that the player is one of ours
+        for (auto &order : message.client_orders.orders) {
+            group->orders.client_orders.orders.push_back(order);
+            group->orders.client_orders.orders.back().player = client->player;
+        }
+        return;
+
+    case Message::CLIENT_TICK_DONE:
+        // Clients can not be done with ticks that we did not send them
+        if (client->ticksDone >= group->ticksReceived)
+            return;
+
+        client->ticksDone++;
+        reportTicks(group);
+        return;
+
+    default:
+        return;
+    }
+}
+
+void Relay::joinGroup(ENetPeer *peer, const Message &message) {
+    if (message.type != Message::CLIENT_CONNECT ||
+        message.client_connect.matchId != 0) {
+        std::cout << "Relay: rejecting peer, only new players can join"
+                  << std::endl;
+        enet_peer_disconnect(peer, 0);
+        return;
+    }
+
+    if (!forming) {
+        forming = new Group;
+        forming->upstream.group = forming;
+        forming->upstream.peer = NULL;
+        forming->upstream.player = 0;
+        forming->upstream.ticksDone = 0;
+        forming->matchId = 0;
+        forming->connectsAnswered = 0;
+        forming->ticksReceived = 0;
+        forming->ticksReported = 0;
+        forming->orders.type = Message::CLIENT_ORDERS;
+    }
+
+    Member *client = new Member;
+    client->group = forming;
+    client->peer = peer;
+    client->name = message.client_connect.name;
+    client->player = 0;
+    client->ticksDone = 0;
+
+    peer->data = client;
+    forming->clients.push_back(client);
+
+    std::cout << "Relay: " << client->name << " joined, "
+              << forming->clients.size() << " of " << seats
+              << " players" << std::endl;
+
+    if (forming->clients.size() == seats) {
+        Group *group = forming;
+        forming = NULL;
+
+        groups.push_back(group);
+        connectUpstream(group);
+    }
+}
+
+void Relay::leaveGroup(Member *client) {
+    Group *group = client->group;
+
+    std::cout << "Relay: " << client->name << " disconnected" << std::endl;
+
+    client->peer->data = NULL;
+    client->peer = NULL;
+
+    // Until the group is complete, the seat is free again
+    if (group == forming) {
+        auto position = std::find(group->clients.begin(),
+                                  group->clients.end(), client);
+        assert(position != group->clients.end());
+        group->clients.erase(position);
+        delete client;
+
+        if (group->clients.empty()) {
+            delete group;
+            forming = NULL;
+        }
+        return;
+    }
+
+    // Seats stay taken in the match, we just stop waiting for them
+    bool anyLeft = std::any_of(group->clients.begin(), group->clients.end(),
+        [](Member *m) { return m->peer != NULL; });
+
+    if (anyLeft) {
+        reportTicks(group);
+        return;
+    }
+
+    ENetPeer *upstream = group->upstream.peer;
+    if (upstream->state == ENET_PEER_STATE_CONNECTED) {
+        enet_peer_disconnect(upstream, 0);
+    } else {
+        enet_peer_reset(upstream);
+        finishGroup(group);
+    }
+}
+
+void Relay::connectUpstream(Group *group) {
+    ENetPeer *peer = enet_host_connect(host, &upstreamAddress, NUM_CHANNELS,
+                                       PROTOCOL_FINGERPRINT);
+    if (!peer) {
+        std::cout << "Relay: no peer left to connect to the server"
+                  << std::endl;
+        finishGroup(group);
+        return;
+    }
+
+    group->upstream.peer = peer;
+    peer->data = &group->upstream;
+}
+
+bool Relay::isConnected(const Group *group) const {
+    return group->upstream.peer &&
+           group->upstream.peer->state == ENET_PEER_STATE_CONNECTED;
+}
+
+// The group is done with a tick once all of its clients are
+void Relay::reportTicks(Group *group) {
+    size_t ticksDone = 0;
+    bool any = false;
+    for (auto client : group->clients) {
+        if (!client->peer)
+            continue;
+
+        ticksDone = any ? std::min(ticksDone, client->ticksDone) :
+                          client->ticksDone;
+        any = true;
+    }
+
+    if (!any || ticksDone <= group->ticksReported || !isConnected(group))
+        return;
+
+    // Orders that were issued before finishing the tick belong
+    // before it, as if the clients had sent them directly
+    flushOrders(group);
+
+    for (; group->ticksReported < ticksDone; group->ticksReported++) {
+        Message message(Message::CLIENT_TICK_DONE);
+        enet_peer_send(group->upstream.peer, CHANNEL_CONTROL,
+                       message.toPacket());
+    }
+}
+
+void Relay::flushOrders(Group *group) {
+    if (group->orders.client_orders.orders.empty() || !isConnected(group))
+        return;
+
+    enet_peer_send(group->upstream.peer, CHANNEL_CONTROL,
+                   group->orders.toPacket());
+    group->orders.client_orders.orders.clear();
+}
+
+void Relay::finishGroup(Group *group) {
+    for (auto client : group->clients) {
+        if (client->peer) {
+            client->peer->data = NULL;
+            enet_peer_disconnect(client->peer, 0);
+        }
+        delete client;
+    }
+
+    if (group->upstream.peer)
+        group->upstream.peer->data = NULL;
+
+    // Only groups that got as far as the server count as a match
+    if (group->matchId != 0) {
+        std::cout << "Relay: match " << group->matchId << " finished"
+                  << std::endl;
+        state.matchesFinished++;
+    }
+
+    auto position = std::find(groups.begin(), groups.end(), group);
+    assert(position != groups.end());
+    groups.erase(position);
+
+    delete group;
+}
+
+void Relay::dumpStats() {
+    lastStats = std::chrono::steady_clock::now();
+
+    size_t numClients = 0;
+    for (auto group : groups) {
+        for (auto client : group->clients)
+            numClients += client->peer != NULL;
+    }
+
+    std::cout << "Relay: " << groups.size() << " groups, " << numClients
+              << " clients; received " << packetsReceived << " packets ("
+              << bytesReceived << " bytes) from the server, forwarded "
+              << packetsForwarded << " packets (" << bytesForwarded
+              << " bytes)" << std::endl;
+
+    packetsReceived = 0;
+    bytesReceived = 0;
+    packetsForwarded = 0;
+    bytesForwarded = 0;
+}
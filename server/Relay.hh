@@ -0,0 +1,104 @@
+#ifndef STRAT_SERVER_RELAY_HH
+#define STRAT_SERVER_RELAY_HH
+
+#include <enet/enet.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "common/GameSettings.hh"
+#include "common/Message.hh"
+#include "server/Shard.hh"
+
+// A relay stands between a server and a group of clients, so that the
+// server sends its messages once per relay instead of once per client.
+//
+// To the clients, a relay looks like a server. It gathers `seats' of them,
+// then connects upstream and takes a seat for each of them in the lobby of
+// the server (see Message::ClientConnect). From then on, it forwards the
+// packets of the server to all clients of the group as they are, and sends
+// their orders upstream in one message per round of events. It reports a
+// tick as done once all of its clients have, so to the server the group is
+// as fast as its slowest client.
+//
+// Clients can not rejoin through a relay, and relays do not provide
+// snapshots of the simulation.
+struct Relay {
+    Relay(ServerState &, const std::string &upstreamHost,
+          uint16_t upstreamPort, uint16_t port, size_t maxPeers,
+          size_t seats);
+    ~Relay();
+
+    Relay(const Relay &) = delete;
+    Relay &operator=(const Relay &) = delete;
+
+    bool isOpen() const { return host != NULL; }
+
+    // Relays until the server state is done
+    void run();
+
+private:
+    struct Group;
+
+    // Every peer of the host points to its member: the clients of a group,
+    // and the group's connection to the server
+    struct Member {
+        Group *group;
+        ENetPeer *peer;     // NULL once disconnected
+
+        std::string name;
+        PlayerId player;    // assigned by the server, zero until then
+        size_t ticksDone;
+    };
+
+    struct Group {
+        Member upstream;
+
+        // In the order of their seats
+        std::vector<Member *> clients;
+
+        uint32_t matchId;   // zero until the server answers
+        size_t connectsAnswered;
+        size_t ticksReceived;   // newest tick the server sent
+        size_t ticksReported;
+
+        // Orders of all clients since the last flush
+        Message orders;
+    };
+
+    ServerState &state;
+    size_t seats;
+
+    ENetAddress upstreamAddress;
+    ENetHost *host;
+
+    // Clients wait here until the group is complete
+    Group *forming;
+    std::vector<Group *> groups;
+
+    // Packets from the server, and the copies we sent on
+    uint64_t packetsReceived;
+    uint64_t bytesReceived;
+    uint64_t packetsForwarded;
+    uint64_t bytesForwarded;
+
+    std::chrono::steady_clock::time_point lastStats;
+
+    void handleEvent(const ENetEvent &);
+    void handleUpstream(Group *, const ENetEvent &);
+    void handleClient(Member *, const Message &);
+    void joinGroup(ENetPeer *, const Message &);
+    void leaveGroup(Member *);
+
+    void connectUpstream(Group *);
+    bool isConnected(const Group *) const;
+    void reportTicks(Group *);
+    void flushOrders(Group *);
+    void finishGroup(Group *);
+    void dumpStats();
+};
+
+#endif
@@ -1,235 +1,172 @@
 #include <enet/enet.h>
 
-#include <algorithm>
 #include <iostream>
-#include <cassert>
+#include <cstdlib>
 #include <ctime>
+#include <string>
 #include <vector>
 
-#include "common/Message.hh"
 #include "common/GameSettings.hh"
-#include "common/BitStream.hh"
-
-struct ClientInfo {
-    ENetPeer *peer;
-
-    size_t ticksDone;
-
-    PlayerInfo player;
-
-    ClientInfo(PlayerId id, ENetPeer *peer)
-        : peer(peer), ticksDone(0), player() {
-        player.id = id;
+#include "common/NetStats.hh"
+#include "server/Match.hh"
+#include "server/Metrics.hh"
+#include "server/Relay.hh"
+#include "server/Shard.hh"
+#include "util/ThreadPool.hh"
+
+// The server hosts any number of matches at once. Matches are spread over
+// shards, each with its own ENet host on port + shard index and its own
+// thread; clients pick a shard by its port.
+//
+// With --relay, it instead relays the matches of another server to its
+// own clients, taking --players of them into a match at once.
+
+int main(int argc, char *argv[]) {
+    MatchConfig config;
+
+    uint16_t port = 1234;
+    size_t numShards = 1;
+    size_t maxPeers = 1024;
+    size_t maxMatches = 0;
+    uint32_t fleetSize = 1;
+    std::string statsFilename;
+    uint16_t metricsPort = 0;
+    std::string relayHost;
+    uint16_t relayPort = 0;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+
+        if (arg == "--record" && i + 1 < argc) {
+            config.replayFilename = argv[++i];
+        } else if (arg == "--tick-redundancy" && i + 1 < argc) {
+            config.tickRedundancy = strtoul(argv[++i], NULL, 10);
+        } else if (arg == "--players" && i + 1 < argc) {
+            config.numPlayers = strtoul(argv[++i], NULL, 10);
+        } else if (arg == "--port" && i + 1 < argc) {
+            port = strtoul(argv[++i], NULL, 10);
+        } else if (arg == "--shards" && i + 1 < argc) {
+            numShards = strtoul(argv[++i], NULL, 10);
+        } else if (arg == "--max-peers" && i + 1 < argc) {
+            maxPeers = strtoul(argv[++i], NULL, 10);
+        } else if (arg == "--matches" && i + 1 < argc) {
+            maxMatches = strtoul(argv[++i], NULL, 10);
+        } else if (arg == "--fleet-size" && i + 1 < argc) {
+            fleetSize = strtoul(argv[++i], NULL, 10);
+        } else if (arg == "--stats" && i + 1 < argc) {
+            statsFilename = argv[++i];
+        } else if (arg == "--metrics-port" && i + 1 < argc) {
+            metricsPort = strtoul(argv[++i], NULL, 10);
+        } else if (arg == "--order-budget" && i + 1 < argc) {
+            config.orderBudget = strtoul(argv[++i], NULL, 10);
+        } else if (arg == "--order-overflow" && i + 1 < argc &&
+                   (std::string(argv[i + 1]) == "drop" ||
+                    std::string(argv[i + 1]) == "merge")) {
+            config.orderOverflow = std::string(argv[++i]) == "drop" ?
+                MatchConfig::OVERFLOW_DROP : MatchConfig::OVERFLOW_MERGE;
+        } else if (arg == "--relay" && i + 1 < argc &&
+                   std::string(argv[i + 1]).find(':') != std::string::npos) {
+            std::string upstream(argv[++i]);
+            size_t colon = upstream.rfind(':');
+            relayHost = upstream.substr(0, colon);
+            relayPort = strtoul(upstream.c_str() + colon + 1, NULL, 10);
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--record FILE] "
+                      << "[--tick-redundancy N] [--players N] [--port PORT] "
+                      << "[--shards N] [--max-peers N] [--matches N] "
+                      << "[--fleet-size N] [--stats FILE] "
+                      << "[--metrics-port PORT] [--order-budget N] "
+                      << "[--order-overflow drop|merge] "
+                      << "[--relay HOST:PORT]" << std::endl;
+            return 1;
+        }
     }
-};
-
-GameSettings settings;
-
-ENetHost *server = NULL;
-bool gameStarted = false;
-
-PlayerId playerCounter = 0;
-std::vector<ClientInfo *> clients;
-
-size_t ticksStarted = 0;
-std::vector<Order> nextOrders;
-
-void sendMessage(ClientInfo *client, const Message &message) {
-    assert(client && client->peer);
-
-    ENetPacket *packet = message.toPacket();
-    enet_peer_send(client->peer, 0, packet);
-}
-
-void broadcast(const Message &message) {
-    for (auto client : clients)
-        sendMessage(client, message);
-}
-
-void startTick() {
-    assert(gameStarted);
-    for (auto client : clients) {
-        assert(client->ticksDone <= ticksStarted);
-        assert(ticksStarted - client->ticksDone <= 2);
 
-        //std::cout << "Client at " << client->ticksDone << std::endl;
+    if (config.numPlayers == 0 || numShards == 0 || maxPeers == 0 ||
+        fleetSize == 0) {
+        std::cerr << "--players, --shards, --max-peers and --fleet-size "
+                  << "must be positive" << std::endl;
+        return 1;
     }
 
-    //std::cout << "Starting tick " << ticksStarted + 1 << std::endl;
-
-    Message message(Message::SERVER_TICK);
-    message.server_tick.orders = nextOrders;
-    broadcast(message);
-
-    ticksStarted++;
-    nextOrders.clear();
-
-    /*for (auto client : clients)
-        client->ticksDone = false;*/
-}
-
-void startGame() {
-    std::cout << "All players connected; starting game" << std::endl;
-
-    assert(!gameStarted);
-
-    // Store player infos in the GameSettings, 
-    // and then broadcast it to the clients
-    assert(settings.players.empty());
-    for (auto client : clients)
-        settings.players.push_back(client->player);
+    // Every match appends a line of JSON whenever it prints its stats
+    StatsFile *statsFile = NULL;
+    if (!statsFilename.empty()) {
+        statsFile = new StatsFile(statsFilename);
 
-    Message message(Message::SERVER_START);
-    message.server_start.settings = settings;
-    broadcast(message);
-
-    gameStarted = true;
-}
+        if (!statsFile->isOpen()) {
+            std::cerr << "Failed to open " << statsFilename << std::endl;
+            return 1;
+        }
 
-void handleMessage(ClientInfo *client, const Message &message) {
-    switch (message.type) {
-    case Message::CLIENT_CONNECT: {
-        client->player.name = message.client_connect.name;
+        config.statsFile = statsFile;
+    }
 
-        Message message(Message::SERVER_CONNECT);
-        message.server_connect.yourPlayerId = client->player.id;
-        sendMessage(client, message);
-        return;
+    if (enet_initialize() != 0) {
+        std::cerr << "Failed to initialize ENet" << std::endl;
+        return 1;
     }
-    case Message::CLIENT_ORDER: {
-        if (!gameStarted) {
-            std::cout << "Ignoring order from player " << client->player.id << std::endl;
-            return;
-        }
 
-        nextOrders.push_back(message.client_order.order);
-        nextOrders.back().player = client->player.id;
+    if (!relayHost.empty()) {
+        ServerState state(maxMatches);
 
-        return;
-    }
-    case Message::CLIENT_TICK_DONE:
-        client->ticksDone++;
-        assert(client->ticksDone <= ticksStarted);
-        return;
+        Relay relay(state, relayHost, relayPort, port, maxPeers,
+                    config.numPlayers);
+        if (!relay.isOpen())
+            return 1;
 
-    default:
-        return;
-    }
-}
+        relay.run();
 
-int main() {
-    if (enet_initialize() != 0) {
-        std::cerr << "Failed to initialize ENet" << std::endl;    
-        return 1;
+        enet_deinitialize();
+
+        return 0;
     }
 
+    // Matches add their id to the seed
+    GameSettings settings;
     settings.randomSeed = static_cast<uint32_t>(time(NULL));
     settings.mapW = 256;
     settings.mapH = 256;
     settings.heightLimit = 8;
     settings.tickLengthMs = 100;
+    settings.fleetSize = fleetSize;
 
-    // Wait for this number of players before starting the game
-    size_t numWaitPlayers = 1;
+    ServerState state(maxMatches);
 
-    ENetAddress address;
-    address.host = ENET_HOST_ANY;
-    address.port = 1234;
+    // Metrics are served to local scrapers only
+    MetricsBoard metricsBoard(numShards);
+    MetricsServer *metricsServer = NULL;
+    if (metricsPort != 0) {
+        metricsServer = new MetricsServer(metricsPort, metricsBoard);
 
-    server = enet_host_create(&address, 32, 2, 0, 0);
+        if (!metricsServer->isOpen())
+            return 1;
 
-    if (server == NULL) {
-        std::cerr << "Failed to create host." << std::endl;
-        return 1;
+        state.metricsBoard = &metricsBoard;
+        state.metricsServer = metricsServer;
     }
 
-    std::cout << "Server started" << std::endl;
-
-    bool quit = false;
-    while (!quit) {
-        if (!gameStarted && clients.size() == numWaitPlayers) {
-            startGame();
-            startTick();
-            startTick();
-        }
-
-        if (gameStarted) {
-            assert(ticksStarted >= 2);
-
-            bool prevTickDone = true;
-            for (auto client : clients) {
-                assert(client->ticksDone <= ticksStarted);
-
-                prevTickDone = prevTickDone && (client->ticksDone >= ticksStarted - 1);
-            }
-
-            if (prevTickDone)
-                startTick();
-        }
-
-        ENetEvent event;
-
-        while (enet_host_service(server, &event, 0) > 0) {
-            switch (event.type) {
-            case ENET_EVENT_TYPE_CONNECT: {
-                std::cout << "A new client connected" << std::endl;
-
-                if (gameStarted) {
-                    std::cout << "Rejecting client since game has started" << std::endl;
-                    enet_peer_reset(event.peer);
-                    // TODO: Cleanup ENet stuff?
-                    break;
-                }
-
-                ClientInfo *client = new ClientInfo(++playerCounter, event.peer);
-                client->player.color = playerCounter % 4;
-                client->player.team = playerCounter;
-
-                event.peer->data = client;
-
-                clients.push_back(client);
-
-                break;
-            }
-            case ENET_EVENT_TYPE_RECEIVE: {
-                ClientInfo *client = static_cast<ClientInfo *>(event.peer->data);
-
-                BitStreamReader reader(event.packet->data, event.packet->dataLength);
+    std::vector<Shard *> shards;
+    for (size_t i = 0; i < numShards; i++) {
+        shards.push_back(new Shard(i, state, config, settings, port + i, maxPeers));
 
-                Message::Type messageType;
-                read(reader, messageType);
-                Message message(messageType);
-                read(reader, message);
-
-                handleMessage(client, message);
-
-                enet_packet_destroy(event.packet);
-                break;
-            }
-            case ENET_EVENT_TYPE_DISCONNECT: {
-                ClientInfo *client = static_cast<ClientInfo *>(event.peer->data);
-                std::cout << "Player " << client->player.id << " disconnected" << std::endl;
-
-                auto position = std::find(clients.begin(), clients.end(), client);
-                assert(position != clients.end());
-                clients.erase(position);
+        if (!shards.back()->isOpen())
+            return 1;
+    }
 
-                delete client;
+    std::cout << "Server started" << std::endl;
 
-                if (clients.empty()) {
-                    std::cout << "All players disconnected" << std::endl;
-                    quit = true;
-                }
+    ThreadPool pool(numShards);
+    pool.run(numShards, [&](size_t shard, size_t) {
+        shards[shard]->run();
+    });
 
-                break;
-            }
+    for (auto shard : shards)
+        delete shard;
 
-            default: assert(false);
-            }
-        }
-    }
+    delete metricsServer;
+    delete statsFile;
 
-    enet_host_destroy(server);
     enet_deinitialize();
 
     return 0;
@@ -0,0 +1,266 @@
+#include "server/Shard.hh"
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+
+#include "common/BitStream.hh"
+
+// How often shards publish their metrics
+static const std::chrono::seconds METRICS_INTERVAL(1);
+
+ServerState::ServerState(size_t maxMatches)
+    : nextMatchId(0),
+      matchesFinished(0),
+      maxMatches(maxMatches),
+      metricsBoard(NULL),
+      metricsServer(NULL) {
+}
+
+bool ServerState::isDone() const {
+    return maxMatches > 0 && matchesFinished >= maxMatches;
+}
+
+Shard::Shard(size_t index, ServerState &state, const MatchConfig &config,
+             const GameSettings &settings, uint16_t port, size_t maxPeers)
+    : index(index),
+      state(state),
+      config(config),
+      settings(settings),
+      host(NULL),
+      lobby(NULL),
+      bytesSent(0),
+      bytesReceived(0),
+      packetsSent(0),
+      packetsReceived(0) {
+    ENetAddress address;
+    address.host = ENET_HOST_ANY;
+    address.port = port;
+
+    host = enet_host_create(&address, maxPeers, NUM_CHANNELS, 0, 0);
+
+    if (host == NULL) {
+        std::cerr << "Failed to create host for shard " << index
+                  << " on port " << port << std::endl;
+        return;
+    }
+
+    std::cout << "Shard " << index << " listening on port " << port << std::endl;
+}
+
+Shard::~Shard() {
+    delete lobby;
+    for (auto match : matches)
+        delete match;
+
+    if (host)
+        enet_host_destroy(host);
+}
+
+void Shard::run() {
+    assert(host);
+
+    while (!state.isDone()) {
+        // Wake up regularly to notice when the server is done
+        uint32_t timeoutMs = 100;
+        for (auto match : matches)
+            timeoutMs = std::min(timeoutMs, match->update());
+
+        if (state.metricsBoard && std::chrono::steady_clock::now() -
+                lastMetricsPublish >= METRICS_INTERVAL)
+            publishMetrics();
+
+        // Only non-blocking calls, so requests wait for at most one timeout
+        if (index == 0 && state.metricsServer)
+            state.metricsServer->poll();
+
+        ENetEvent event;
+
+        int result = enet_host_service(host, &event, timeoutMs);
+        while (result > 0) {
+            handleEvent(event);
+            result = enet_host_service(host, &event, 0);
+        }
+    }
+}
+
+void Shard::handleConnect(ENetPeer *peer, const Message &message) {
+    if (message.type != Message::CLIENT_CONNECT) {
+        std::cout << "Shard " << index << ": unexpected message from new peer"
+                  << std::endl;
+        enet_peer_disconnect(peer, 0);
+        return;
+    }
+
+    if (message.client_connect.matchId == 0) {
+        joinLobby(peer, message);
+        return;
+    }
+
+    auto match = std::find_if(matches.begin(), matches.end(),
+        [&](Match *m) { return m->getId() == message.client_connect.matchId; });
+
+    if (match == matches.end() ||
+        !(*match)->rejoinClient(peer, message.client_connect)) {
+        std::cout << "Shard " << index << ": rejecting rejoin of player "
+                  << message.client_connect.playerId << " to match "
+                  << message.client_connect.matchId << std::endl;
+        enet_peer_disconnect(peer, 0);
+    }
+}
+
+void Shard::joinLobby(ENetPeer *peer, const Message &message) {
+    // A relay takes a seat for each of its clients, all in the same match
+    const std::vector<std::string> &relayedNames =
+        message.client_connect.relayedNames;
+    bool relayed = !relayedNames.empty();
+    size_t seats = relayed ? relayedNames.size() : 1;
+
+    if (seats > config.numPlayers ||
+        (lobby && lobby->freeSeats() < seats)) {
+        std::cout << "Shard " << index << ": no room for a relay with "
+                  << seats << " players" << std::endl;
+        enet_peer_disconnect(peer, 0);
+        return;
+    }
+
+    if (!lobby) {
+        // Every match gets its own map
+        GameSettings matchSettings = settings;
+        size_t id = ++state.nextMatchId;
+        matchSettings.randomSeed += id;
+
+        lobby = new Match(id, config, matchSettings);
+    }
+
+    for (size_t i = 0; i < seats; i++) {
+        ClientInfo *client = lobby->addClient(peer, relayed);
+
+        if (relayed) {
+            Message connect(Message::CLIENT_CONNECT);
+            connect.client_connect.name = relayedNames[i];
+            lobby->handleMessage(client, connect);
+        } else {
+            lobby->handleMessage(client, message);
+        }
+
+        std::cout << "Match " << lobby->getId() << ": player "
+                  << client->player.id << " joined on shard " << index
+                  << (relayed ? " through a relay" : "") << std::endl;
+    }
+
+    if (lobby->isFull()) {
+        lobby->start();
+        matches.push_back(lobby);
+        lobby = NULL;
+    }
+}
+
+void Shard::finishMatch(Match *match) {
+    std::cout << "Match " << match->getId() << ": all players disconnected"
+              << std::endl;
+
+    auto position = std::find(matches.begin(), matches.end(), match);
+    assert(position != matches.end());
+    matches.erase(position);
+
+    delete match;
+
+    state.matchesFinished++;
+}
+
+void Shard::publishMetrics() {
+    lastMetricsPublish = std::chrono::steady_clock::now();
+
+    bytesSent += host->totalSentData;
+    bytesReceived += host->totalReceivedData;
+    packetsSent += host->totalSentPackets;
+    packetsReceived += host->totalReceivedPackets;
+    host->totalSentData = 0;
+    host->totalReceivedData = 0;
+    host->totalSentPackets = 0;
+    host->totalReceivedPackets = 0;
+
+    std::string labels = "shard=\"" + std::to_string(index) + "\"";
+
+    std::vector<MetricSample> samples;
+    addSample(samples, "strat_shard_connected_peers", labels,
+              host->connectedPeers);
+    addSample(samples, "strat_shard_matches", labels, matches.size());
+    addSample(samples, "strat_shard_bytes_sent_total", labels, bytesSent);
+    addSample(samples, "strat_shard_bytes_received_total", labels, bytesReceived);
+    addSample(samples, "strat_shard_packets_sent_total", labels, packetsSent);
+    addSample(samples, "strat_shard_packets_received_total", labels,
+              packetsReceived);
+
+    if (lobby)
+        lobby->collectMetrics(samples);
+    for (auto match : matches)
+        match->collectMetrics(samples);
+
+    state.metricsBoard->publish(index, samples);
+}
+
+void Shard::handleEvent(const ENetEvent &event) {
+    switch (event.type) {
+    case ENET_EVENT_TYPE_CONNECT:
+        // Wait for CLIENT_CONNECT to know what the peer wants
+        event.peer->data = NULL;
+
+        if (event.data != PROTOCOL_FINGERPRINT) {
+            std::cout << "Shard " << index << ": rejecting peer with protocol "
+                      << event.data << ", ours is " << PROTOCOL_FINGERPRINT
+                      << std::endl;
+            enet_peer_disconnect(event.peer, PROTOCOL_FINGERPRINT);
+        }
+        break;
+
+    case ENET_EVENT_TYPE_RECEIVE: {
+        ClientInfo *client = static_cast<ClientInfo *>(event.peer->data);
+
+        BitStreamReader reader(event.packet->data, event.packet->dataLength);
+
+        Message message;
+        read(reader, message);
+
+        if (reader.hasFailed()) {
+            std::cout << "Shard " << index << ": dropping peer that sent a "
+                      << "malformed packet" << std::endl;
+            enet_peer_disconnect(event.peer, 0);
+            enet_packet_destroy(event.packet);
+            break;
+        }
+
+        if (client) {
+            client->stats.received.add(message.type, event.packet->dataLength);
+            client->match->handleMessage(client, message);
+        }
+        else
+            handleConnect(event.peer, message);
+
+        enet_packet_destroy(event.packet);
+        break;
+    }
+    case ENET_EVENT_TYPE_DISCONNECT: {
+        ClientInfo *client = static_cast<ClientInfo *>(event.peer->data);
+        if (!client)
+            break;
+
+        Match *match = client->match;
+
+        std::cout << "Match " << match->getId() << ": "
+                  << (client->relayHead ? "relay of player " : "player ")
+                  << client->player.id << " disconnected" << std::endl;
+
+        match->removeClient(client);
+        event.peer->data = NULL;
+
+        if (match != lobby && match->isEmpty())
+            finishMatch(match);
+
+        break;
+    }
+
+    default: assert(false);
+    }
+}
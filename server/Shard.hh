@@ -0,0 +1,82 @@
+#ifndef STRAT_SERVER_SHARD_HH
+#define STRAT_SERVER_SHARD_HH
+
+#include <enet/enet.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "common/GameSettings.hh"
+#include "server/Match.hh"
+#include "server/Metrics.hh"
+
+// State shared by all shards of a server
+struct ServerState {
+    std::atomic<size_t> nextMatchId;
+    std::atomic<size_t> matchesFinished;
+
+    // Stop once this many matches have finished, zero runs forever
+    size_t maxMatches;
+
+    // Where shards publish their metrics, NULL if disabled. The first
+    // shard answers the requests of the server.
+    MetricsBoard *metricsBoard;
+    MetricsServer *metricsServer;
+
+    explicit ServerState(size_t maxMatches = 0);
+
+    bool isDone() const;
+};
+
+// A shard owns one ENet host and all matches of the peers that connect
+// to it, and runs them on its own thread. Shards share no matches or
+// peers, so they need no locking.
+//
+// Connecting peers say hello with CLIENT_CONNECT. New players wait in the
+// lobby, a match that has not started yet, until it is full; players that
+// lost their connection rejoin their running match. Finished matches are
+// deleted.
+struct Shard {
+    Shard(size_t index, ServerState &, const MatchConfig &,
+          const GameSettings &, uint16_t port, size_t maxPeers);
+    ~Shard();
+
+    Shard(const Shard &) = delete;
+    Shard &operator=(const Shard &) = delete;
+
+    bool isOpen() const { return host != NULL; }
+
+    // Serves the matches until the server is done
+    void run();
+
+private:
+    size_t index;
+    ServerState &state;
+
+    const MatchConfig &config;
+    GameSettings settings;
+
+    ENetHost *host;
+
+    Match *lobby;
+    std::vector<Match *> matches;
+
+    // Traffic of the host, which ENet counts in 32 bits
+    uint64_t bytesSent;
+    uint64_t bytesReceived;
+    uint64_t packetsSent;
+    uint64_t packetsReceived;
+
+    std::chrono::steady_clock::time_point lastMetricsPublish;
+
+    void handleEvent(const ENetEvent &);
+    void handleConnect(ENetPeer *, const Message &);
+    void joinLobby(ENetPeer *, const Message &);
+    void finishMatch(Match *);
+    void publishMetrics();
+};
+
+#endif
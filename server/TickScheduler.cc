@@ -0,0 +1,74 @@
+#include "server/TickScheduler.hh"
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+#include <sstream>
+
+TickScheduler::Stats::Stats()
+    : ticks(0),
+      lateTicks(0),
+      resyncs(0),
+      totalLatenessMs(0),
+      maxLatenessMs(0) {
+}
+
+TickScheduler::TickScheduler(uint32_t tickLengthMs, size_t maxLateTicks)
+    : tickLength(std::chrono::milliseconds(tickLengthMs)),
+      maxLateTicks(maxLateTicks) {
+    assert(tickLengthMs > 0);
+}
+
+void TickScheduler::start() {
+    deadline = Clock::now() + tickLength;
+}
+
+bool TickScheduler::isDue() const {
+    return Clock::now() >= deadline;
+}
+
+uint32_t TickScheduler::getTimeoutMs() const {
+    Clock::duration remaining = deadline - Clock::now();
+    if (remaining <= Clock::duration::zero())
+        return 0;
+
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(remaining);
+    if (ms < remaining)
+        ms += std::chrono::milliseconds(1);
+
+    return static_cast<uint32_t>(ms.count());
+}
+
+void TickScheduler::tickStarted() {
+    Clock::time_point now = Clock::now();
+
+    double latenessMs = std::chrono::duration<double, std::milli>(
+        now - deadline).count();
+    latenessMs = std::max(latenessMs, 0.0);
+
+    stats.ticks++;
+    stats.totalLatenessMs += latenessMs;
+    stats.maxLatenessMs = std::max(stats.maxLatenessMs, latenessMs);
+    if (latenessMs > 1.0)
+        stats.lateTicks++;
+
+    deadline += tickLength;
+
+    if (now - deadline > tickLength * static_cast<int>(maxLateTicks)) {
+        deadline = now + tickLength;
+        stats.resyncs++;
+    }
+}
+
+void TickScheduler::dumpStats(const std::string &prefix) {
+    std::ostringstream out;
+    out << prefix << "Ticks: " << stats.ticks << ", "
+        << stats.lateTicks << " late, "
+        << "lateness avg " << (stats.ticks > 0 ?
+                               stats.totalLatenessMs / stats.ticks : 0.0)
+        << "ms, max " << stats.maxLatenessMs << "ms, "
+        << stats.resyncs << " resyncs\n";
+    std::cout << out.str() << std::flush;
+
+    stats = Stats();
+}
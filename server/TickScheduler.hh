@@ -0,0 +1,60 @@
+#ifndef STRAT_SERVER_TICK_SCHEDULER_HH
+#define STRAT_SERVER_TICK_SCHEDULER_HH
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Decides when the server starts the next tick.
+//
+// Ticks are scheduled on a fixed timeline: the deadline of tick n is
+// start + n * tickLength, independent of when the previous ticks actually
+// started. This way small delays (e.g. from the granularity of
+// enet_host_service timeouts) do not accumulate. If the server falls
+// behind by more than `maxLateTicks' ticks, e.g. because clients were
+// too slow to acknowledge, the timeline is reset instead of emitting a
+// burst of ticks to catch up.
+struct TickScheduler {
+    typedef std::chrono::steady_clock Clock;
+
+    struct Stats {
+        size_t ticks;
+        size_t lateTicks;    // ticks started more than 1ms after the deadline
+        size_t resyncs;      // timeline resets
+        double totalLatenessMs;
+        double maxLatenessMs;
+
+        Stats();
+    };
+
+    TickScheduler(uint32_t tickLengthMs, size_t maxLateTicks = 3);
+
+    // Starts the timeline, the first deadline is one tick from now
+    void start();
+
+    bool isDue() const;
+
+    // Timeout to pass to enet_host_service: the milliseconds until the
+    // next deadline, rounded up so that we do not wake up too early
+    uint32_t getTimeoutMs() const;
+
+    // Call when the tick has been started; records how late it is
+    // and advances the deadline
+    void tickStarted();
+
+    const Stats &getStats() const { return stats; }
+
+    // Prints the stats, each line starting with `prefix', and resets them
+    void dumpStats(const std::string &prefix = "");
+
+private:
+    Clock::duration tickLength;
+    size_t maxLateTicks;
+
+    Clock::time_point deadline;
+
+    Stats stats;
+};
+
+#endif
@@ -0,0 +1,237 @@
+// broadcastbench measures the cost of broadcasting SERVER_TICK messages
+// from the server to many clients over loopback.
+//
+// It compares serializing the message into a separate packet per client
+// with serializing it once into one packet that is shared by all clients,
+// which is what the server does.
+//
+// Usage: broadcastbench [options]
+//   --peers N     number of clients (default 32)
+//   --orders N    orders per tick (default 256)
+//   --ticks N     ticks to broadcast per mode (default 1000)
+//   --port N      port of the benchmark server (default 12345)
+
+#include "common/BitStream.hh"
+#include "common/Message.hh"
+#include "common/Order.hh"
+
+#include <enet/enet.h>
+
+#include <cassert>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+struct Bench {
+    ENetHost *server;
+    std::vector<ENetHost *> clients;
+    std::vector<ENetPeer *> peers; // server side
+
+    size_t packetsCreated;
+    size_t packetsReceived;
+    size_t bytesReceived;
+
+    Bench()
+        : server(NULL), packetsCreated(0), packetsReceived(0), bytesReceived(0) {
+    }
+
+    ~Bench() {
+        for (auto client : clients)
+            enet_host_destroy(client);
+        if (server)
+            enet_host_destroy(server);
+    }
+
+    bool connect(size_t numPeers, enet_uint16 port) {
+        ENetAddress address;
+        address.host = ENET_HOST_ANY;
+        address.port = port;
+
+        server = enet_host_create(&address, numPeers, NUM_CHANNELS, 0, 0);
+        if (server == NULL) {
+            std::cerr << "Failed to create server host on port " << port
+                      << std::endl;
+            return false;
+        }
+
+        enet_address_set_host(&address, "127.0.0.1");
+
+        for (size_t i = 0; i < numPeers; i++) {
+            ENetHost *client = enet_host_create(NULL, 1, NUM_CHANNELS, 0, 0);
+            if (client == NULL || !enet_host_connect(client, &address, NUM_CHANNELS, 0)) {
+                std::cerr << "Failed to create client host" << std::endl;
+                return false;
+            }
+
+            clients.push_back(client);
+        }
+
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (peers.size() < numPeers) {
+            if (std::chrono::steady_clock::now() > deadline) {
+                std::cerr << "Timed out connecting the clients" << std::endl;
+                return false;
+            }
+
+            pump();
+        }
+
+        pump();
+        return true;
+    }
+
+    // Delivers everything that is in flight to the clients
+    void pump() {
+        ENetEvent event;
+
+        enet_host_flush(server);
+
+        for (auto client : clients) {
+            while (enet_host_service(client, &event, 0) > 0) {
+                if (event.type == ENET_EVENT_TYPE_RECEIVE) {
+                    packetsReceived++;
+                    bytesReceived += event.packet->dataLength;
+                    enet_packet_destroy(event.packet);
+                }
+            }
+        }
+
+        // Process connections and acknowledgements
+        while (enet_host_service(server, &event, 0) > 0) {
+            if (event.type == ENET_EVENT_TYPE_CONNECT)
+                peers.push_back(event.peer);
+            else if (event.type == ENET_EVENT_TYPE_RECEIVE)
+                enet_packet_destroy(event.packet);
+        }
+    }
+
+    void broadcastPerPeer(const Message &message) {
+        for (auto peer : peers) {
+            enet_peer_send(peer, 0, message.toPacket());
+            packetsCreated++;
+        }
+    }
+
+    void broadcastShared(const Message &message) {
+        ENetPacket *packet = message.toPacket();
+        packetsCreated++;
+
+        for (auto peer : peers)
+            enet_peer_send(peer, 0, packet);
+
+        if (packet->referenceCount == 0)
+            enet_packet_destroy(packet);
+    }
+};
+
+static void fillTick(Message &message, size_t numOrders, size_t numPeers,
+                     uint32_t &seq) {
+    message.server_tick.tick++;
+    message.server_tick.ticks.resize(1);
+
+    TickOrders &orders = message.server_tick.ticks[0];
+    orders.clear();
+
+    for (size_t i = 0; i < numOrders; i++) {
+        Order order(Order::ACCELERATE);
+        order.player = 1 + i % numPeers;
+        order.seq = ++seq;
+        order.tick = message.server_tick.tick;
+        order.accelerate.direction = static_cast<Direction>(i % 4);
+        orders.push_back(order);
+    }
+}
+
+static void run(Bench &bench, bool shared, size_t numTicks, size_t numOrders) {
+    bench.packetsCreated = 0;
+    bench.packetsReceived = 0;
+    bench.bytesReceived = 0;
+
+    Message message(Message::SERVER_TICK);
+    message.server_tick.tick = 0;
+    message.server_tick.inputDelay = 1;
+    uint32_t seq = 0;
+    double broadcastS = 0;
+
+    auto startTime = std::chrono::steady_clock::now();
+
+    for (size_t tick = 0; tick < numTicks; tick++) {
+        fillTick(message, numOrders, bench.peers.size(), seq);
+
+        auto broadcastStart = std::chrono::steady_clock::now();
+
+        if (shared)
+            bench.broadcastShared(message);
+        else
+            bench.broadcastPerPeer(message);
+
+        broadcastS += std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - broadcastStart).count();
+
+        bench.pump();
+    }
+
+    double elapsedS = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - startTime).count();
+
+    std::cout << (shared ? "shared:   " : "per peer: ")
+              << broadcastS * 1e6 / numTicks << "us/tick in broadcast, "
+              << bench.packetsCreated << " packets created, "
+              << bench.packetsReceived << " received ("
+              << bench.bytesReceived / numTicks << " bytes/tick), "
+              << elapsedS << "s total" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    size_t numPeers = 32;
+    size_t numOrders = 256;
+    size_t numTicks = 1000;
+    enet_uint16 port = 12345;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        bool haveValue = i + 1 < argc;
+
+        if (arg == "--peers" && haveValue)
+            numPeers = strtoul(argv[++i], NULL, 10);
+        else if (arg == "--orders" && haveValue)
+            numOrders = strtoul(argv[++i], NULL, 10);
+        else if (arg == "--ticks" && haveValue)
+            numTicks = strtoul(argv[++i], NULL, 10);
+        else if (arg == "--port" && haveValue)
+            port = strtoul(argv[++i], NULL, 10);
+        else {
+            std::cerr << "Usage: broadcastbench [--peers N] [--orders N] "
+                      << "[--ticks N] [--port N]" << std::endl;
+            return 1;
+        }
+    }
+
+    if (numPeers == 0 || numTicks == 0) {
+        std::cerr << "Need at least one peer and one tick" << std::endl;
+        return 1;
+    }
+
+    if (enet_initialize() != 0) {
+        std::cerr << "Failed to initialize ENet" << std::endl;
+        return 1;
+    }
+
+    {
+        Bench bench;
+        if (!bench.connect(numPeers, port))
+            return 1;
+
+        std::cout << "Broadcasting " << numTicks << " ticks with " << numOrders
+                  << " orders to " << numPeers << " peers" << std::endl;
+
+        run(bench, false, numTicks, numOrders);
+        run(bench, true, numTicks, numOrders);
+    }
+
+    enet_deinitialize();
+
+    return 0;
+}
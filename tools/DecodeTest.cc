@@ -0,0 +1,202 @@
+// decodetest feeds the message decoder with malformed input, as a peer
+// could send it, and checks that every case is rejected by failing the
+// reader rather than by crashing or allocating what the input claims.
+// Well-formed messages must still decode to what was encoded.
+//
+// Usage: decodetest
+//
+// Prints each failing case and exits with status 1 if there is any.
+
+#include "common/BitStream.hh"
+#include "common/Message.hh"
+#include "common/Order.hh"
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+static size_t numFailures = 0;
+
+static void check(bool condition, const std::string &what) {
+    if (!condition) {
+        std::cout << "FAILED: " << what << std::endl;
+        numFailures++;
+    }
+}
+
+static std::vector<uint8_t> encode(const Message &message) {
+    BitStreamWriter writer;
+    write(writer, message);
+    return std::vector<uint8_t>(writer.ptr(), writer.ptr() + writer.size());
+}
+
+// Decodes `data' and returns whether the reader accepted it
+static bool decode(const uint8_t *data, size_t size, Message &message) {
+    BitStreamReader reader(data, size);
+    read(reader, message);
+    return !reader.hasFailed();
+}
+
+static Message makeTick() {
+    Message message(Message::SERVER_TICK);
+    message.server_tick.tick = 1234;
+    message.server_tick.inputDelay = 2;
+
+    for (uint32_t i = 0; i < 3; i++) {
+        TickOrders orders;
+
+        Order order(Order::ACCELERATE);
+        order.player = i + 1;
+        order.seq = 100 + i;
+        order.tick = 1232 + i;
+        order.units.addRange(i, 5);
+        order.accelerate.direction = DIRECTION_FORWARD;
+        order.accelerate.count = 7;
+
+        orders.push_back(order);
+        message.server_tick.ticks.push_back(orders);
+        message.server_tick.holdUs.push_back(500 * i);
+    }
+
+    return message;
+}
+
+static Message makeConnect() {
+    Message message(Message::CLIENT_CONNECT);
+    message.client_connect.name = "player";
+    message.client_connect.matchId = 3;
+    message.client_connect.playerId = 2;
+    message.client_connect.relayedNames.push_back("a");
+    message.client_connect.relayedNames.push_back("b");
+    return message;
+}
+
+static void testRoundTrip() {
+    Message tick = makeTick();
+    std::vector<uint8_t> data = encode(tick);
+
+    Message decoded;
+    check(decode(&data[0], data.size(), decoded), "valid SERVER_TICK");
+    check(decoded.type == Message::SERVER_TICK &&
+          decoded.server_tick.tick == 1234 &&
+          decoded.server_tick.ticks.size() == 3 &&
+          decoded.server_tick.ticks[2][0].units ==
+              tick.server_tick.ticks[2][0].units &&
+          decoded.server_tick.holdUs[2] == 1000,
+          "SERVER_TICK round trip");
+
+    Message connect = makeConnect();
+    data = encode(connect);
+
+    check(decode(&data[0], data.size(), decoded), "valid CLIENT_CONNECT");
+    check(decoded.client_connect.name == "player" &&
+          decoded.client_connect.relayedNames.size() == 2,
+          "CLIENT_CONNECT round trip");
+}
+
+// The last byte always holds some of the data, so every proper prefix
+// of an encoding is missing bits that the decoder needs
+static void testTruncated(const Message &message, const std::string &name) {
+    std::vector<uint8_t> data = encode(message);
+
+    for (size_t size = 0; size < data.size(); size++) {
+        Message decoded;
+        check(!decode(size > 0 ? &data[0] : NULL, size, decoded),
+              name + " truncated to " + std::to_string(size) + " bytes");
+    }
+}
+
+static void testOversizedLengths() {
+    // A name that claims to be a terabyte long
+    BitStreamWriter writer;
+    writeRanged(writer, Message::CLIENT_CONNECT, Message::SERVER_SNAPSHOT);
+    writeVarint(writer, uint64_t(1) << 40);
+    writer.writeBytes(reinterpret_cast<const uint8_t *>("abcd"), 4);
+
+    Message decoded;
+    check(!decode(writer.ptr(), writer.size(), decoded),
+          "CLIENT_CONNECT with an oversized name");
+    check(decoded.client_connect.name.capacity() < 1024,
+          "oversized name is not allocated");
+
+    // More orders than the rest of the packet can hold
+    writer.reset();
+    writeRanged(writer, Message::CLIENT_ORDERS, Message::SERVER_SNAPSHOT);
+    writeVarint(writer, 100000);
+    writeVarint(writer, 1);
+
+    check(!decode(writer.ptr(), writer.size(), decoded),
+          "CLIENT_ORDERS with an oversized order count");
+
+    // Snapshot data that is longer than the packet
+    writer.reset();
+    writeRanged(writer, Message::CLIENT_SNAPSHOT, Message::SERVER_SNAPSHOT);
+    for (int i = 0; i < 4; i++)
+        writeVarint(writer, 1);
+    writeVarint(writer, 1 << 20);
+    writeVarint(writer, 0);
+
+    check(!decode(writer.ptr(), writer.size(), decoded),
+          "CLIENT_SNAPSHOT with oversized data");
+    check(decoded.snapshot_chunk.data.capacity() < 1024,
+          "oversized snapshot data is not allocated");
+
+    // A varint that does not end within 64 bits
+    writer.reset();
+    writeRanged(writer, Message::SERVER_CONNECT, Message::SERVER_SNAPSHOT);
+    for (int i = 0; i < 12; i++)
+        writer.writeBits(0xff, 8);
+
+    check(!decode(writer.ptr(), writer.size(), decoded),
+          "SERVER_CONNECT with an endless varint");
+}
+
+static void testUnknownTags() {
+    // The type has room for values beyond the last one
+    unsigned bits = bitsForRange(Message::SERVER_SNAPSHOT);
+
+    for (uint64_t type = 0; type < (uint64_t(1) << bits); type++) {
+        if (type > Message::UNDEFINED && type <= Message::SERVER_SNAPSHOT)
+            continue;
+
+        BitStreamWriter writer;
+        writer.writeBits(type, bits);
+        writer.writeBits(0, 8);
+
+        Message decoded;
+        check(!decode(writer.ptr(), writer.size(), decoded),
+              "message type " + std::to_string(type));
+    }
+
+    // An order of an unknown type inside a valid message
+    BitStreamWriter writer;
+    writeRanged(writer, Message::CLIENT_ORDERS, Message::SERVER_SNAPSHOT);
+    writeVarint(writer, 1);                      // number of orders
+    writeVarint(writer, 1);                      // player
+    writeVarint(writer, 1);                      // seq
+    writeVarint(writer, 1);                      // tick
+    writeVarint(writer, 0);                      // unit ranges
+    writeRanged(writer, Order::UNDEFINED, Order::ACCELERATE);
+    writer.writeBits(0, 8);
+
+    Message decoded;
+    check(!decode(writer.ptr(), writer.size(), decoded),
+          "order of type UNDEFINED");
+}
+
+int main() {
+    testRoundTrip();
+    testTruncated(makeTick(), "SERVER_TICK");
+    testTruncated(makeConnect(), "CLIENT_CONNECT");
+    testOversizedLengths();
+    testUnknownTags();
+
+    if (numFailures > 0) {
+        std::cout << numFailures << " checks failed" << std::endl;
+        return 1;
+    }
+
+    std::cout << "All checks passed" << std::endl;
+    return 0;
+}
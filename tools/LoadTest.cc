@@ -0,0 +1,468 @@
+// loadtest connects headless bot clients to a running server and reports
+// how well the server keeps up as the number of clients and the order
+// rate go up.
+//
+// Every bot has its own ENet host. Bots issue random ACCELERATE orders
+// and acknowledge each tick as soon as it arrives, without simulating or
+// rendering anything. For every combination of client count and order
+// rate, a fresh set of bots runs for a while and then disconnects, so the
+// server should be started with a large enough --matches (or none).
+//
+// Usage: loadtest [options]
+//   --host HOST           server address (default 127.0.0.1)
+//   --port N              port of the first shard (default 1234)
+//   --shards N            spread the bots over the ports port, port + 1, ...
+//                         (default 1)
+//   --clients N[,N...]    number of bots per run (default 8)
+//   --order-rate R[,R...] orders per second and bot (default 5)
+//   --seconds N           measurement time per run (default 10)
+//   --threads N           number of threads servicing the bots
+//                         (default: one per hardware thread)
+//   --server-pid PID      also report the CPU usage of the server (Linux)
+//
+// For each run, the output has the tick rate seen by an average bot,
+// percentiles of how late ticks arrived relative to a steady timeline,
+// the received bytes per tick and bot, and the CPU usage.
+
+#include "common/BitStream.hh"
+#include "common/Message.hh"
+#include "common/Order.hh"
+#include "util/ThreadPool.hh"
+
+#include <enet/enet.h>
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+typedef std::chrono::steady_clock Clock;
+
+// Orders are sent together with the next tick acknowledgement,
+// or after this delay
+static const double ORDER_FLUSH_DELAY_S = 0.02;
+
+struct Bot {
+    ENetHost *host;
+    ENetPeer *peer;
+
+    bool connected;
+    bool started;
+    uint32_t tickLengthMs;
+
+    size_t ticksReceived;
+    size_t inputDelay;
+
+    double orderRate;
+    double orderDebt;
+    std::vector<Order> outgoingOrders;
+    double outgoingOrdersAge;
+    uint32_t orderCounter;
+    std::mt19937 random;
+
+    // Ticks received during the measurement, and when they arrived
+    bool measuring;
+    size_t ticksMeasured;
+    std::vector<std::pair<size_t, double>> arrivals;
+    size_t bytesAtStart;
+
+    Bot(size_t index, double orderRate)
+        : host(NULL), peer(NULL),
+          connected(false), started(false), tickLengthMs(0),
+          ticksReceived(0), inputDelay(2),
+          orderRate(orderRate), orderDebt(0), outgoingOrdersAge(0),
+          orderCounter(0), random(index),
+          measuring(false), ticksMeasured(0), bytesAtStart(0) {
+    }
+
+    ~Bot() {
+        if (peer) {
+            enet_peer_disconnect_now(peer, 0);
+            enet_host_flush(host);
+        }
+        if (host)
+            enet_host_destroy(host);
+    }
+
+    bool connect(const ENetAddress &address) {
+        host = enet_host_create(NULL, 1, NUM_CHANNELS, 0, 0);
+        if (host == NULL)
+            return false;
+
+        peer = enet_host_connect(host, &address, NUM_CHANNELS,
+                                 PROTOCOL_FINGERPRINT);
+        return peer != NULL;
+    }
+
+    void send(const Message &message) {
+        enet_peer_send(peer, CHANNEL_CONTROL, message.toPacket());
+    }
+
+    void flushOrders() {
+        outgoingOrdersAge = 0;
+
+        if (outgoingOrders.empty())
+            return;
+
+        Message message(Message::CLIENT_ORDERS);
+        message.client_orders.orders.assign(outgoingOrders.begin(),
+                                            outgoingOrders.end());
+        send(message);
+
+        outgoingOrders.clear();
+    }
+
+    void handleMessage(const Message &message, double timeS) {
+        switch (message.type) {
+        case Message::SERVER_START:
+            started = true;
+            tickLengthMs = message.server_start.settings.tickLengthMs;
+            return;
+
+        case Message::SERVER_TICK: {
+            const Message::ServerTick &serverTick = message.server_tick;
+            size_t firstTick = serverTick.tick + 1 - serverTick.ticks.size();
+
+            inputDelay = serverTick.inputDelay;
+
+            for (size_t tick = firstTick; tick <= serverTick.tick; tick++) {
+                if (tick != ticksReceived + 1)
+                    continue;
+
+                ticksReceived = tick;
+
+                if (measuring) {
+                    ticksMeasured++;
+                    arrivals.push_back(std::make_pair(tick, timeS));
+                }
+
+                // There is no simulation to run, so the tick is done
+                flushOrders();
+                send(Message(Message::CLIENT_TICK_DONE));
+            }
+            return;
+        }
+
+        default:
+            return;
+        }
+    }
+
+    void update(double dt, double timeS) {
+        if (started) {
+            orderDebt += orderRate * dt;
+
+            while (orderDebt >= 1) {
+                orderDebt -= 1;
+
+                // The server fills in the player
+                Order order(Order::ACCELERATE);
+                order.player = 0;
+                order.seq = ++orderCounter;
+                order.tick = ticksReceived + inputDelay;
+                order.accelerate.direction = static_cast<Direction>(random() % 4);
+
+                if (!outgoingOrders.empty() && outgoingOrders.back().canMerge(order))
+                    outgoingOrders.back().merge(order);
+                else
+                    outgoingOrders.push_back(order);
+            }
+
+            outgoingOrdersAge += dt;
+            if (outgoingOrdersAge >= ORDER_FLUSH_DELAY_S)
+                flushOrders();
+        }
+
+        ENetEvent event;
+        while (enet_host_service(host, &event, 0) > 0) {
+            switch (event.type) {
+            case ENET_EVENT_TYPE_CONNECT: {
+                connected = true;
+
+                Message message(Message::CLIENT_CONNECT);
+                message.client_connect.name = "bot";
+                send(message);
+                break;
+            }
+            case ENET_EVENT_TYPE_RECEIVE: {
+                BitStreamReader reader(event.packet->data, event.packet->dataLength);
+
+                Message message;
+                read(reader, message);
+
+                if (!reader.hasFailed())
+                    handleMessage(message, timeS);
+
+                enet_packet_destroy(event.packet);
+                break;
+            }
+            case ENET_EVENT_TYPE_DISCONNECT:
+                connected = false;
+                started = false;
+                peer = NULL;
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    void startMeasuring() {
+        measuring = true;
+        ticksMeasured = 0;
+        arrivals.clear();
+        bytesAtStart = host->totalReceivedData;
+    }
+
+    // Lateness of every arrival relative to a timeline with one tick
+    // every tickLengthMs, aligned to the earliest arrival
+    void getLateness(std::vector<double> &latenessMs) const {
+        if (arrivals.empty())
+            return;
+
+        double anchor = 1e300;
+        for (auto &arrival : arrivals)
+            anchor = std::min(anchor, arrival.second * 1000.0 -
+                                      arrival.first * tickLengthMs);
+
+        for (auto &arrival : arrivals)
+            latenessMs.push_back(arrival.second * 1000.0 -
+                                 arrival.first * tickLengthMs - anchor);
+    }
+};
+
+// Process CPU time in seconds, of this process or of `pid'
+static double cpuTimeS(long pid = 0) {
+    if (pid == 0)
+        return static_cast<double>(std::clock()) / CLOCKS_PER_SEC;
+
+#ifdef __linux__
+    std::ifstream file("/proc/" + std::to_string(pid) + "/stat");
+    std::string line;
+    if (!std::getline(file, line))
+        return 0;
+
+    // The fields after the command name, which is in parentheses
+    std::istringstream ss(line.substr(line.rfind(')') + 2));
+    std::string field;
+    unsigned long utime = 0, stime = 0;
+    for (size_t i = 3; i <= 15 && ss >> field; i++) {
+        if (i == 14)
+            utime = strtoul(field.c_str(), NULL, 10);
+        else if (i == 15)
+            stime = strtoul(field.c_str(), NULL, 10);
+    }
+
+    return static_cast<double>(utime + stime) / sysconf(_SC_CLK_TCK);
+#else
+    return 0;
+#endif
+}
+
+static double percentile(const std::vector<double> &sorted, double p) {
+    if (sorted.empty())
+        return 0;
+
+    size_t index = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+    return sorted[index];
+}
+
+struct RunConfig {
+    std::string host;
+    enet_uint16 port;
+    size_t numShards;
+    size_t numClients;
+    double orderRate;
+    double seconds;
+    long serverPid;
+};
+
+// Services the bots `thread', `thread + numThreads', ... until `end'
+static void serviceBots(std::vector<Bot *> &bots, size_t thread,
+                        size_t numThreads, Clock::time_point start,
+                        Clock::time_point end) {
+    Clock::time_point last = Clock::now();
+
+    while (last < end) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+        Clock::time_point now = Clock::now();
+        double dt = std::chrono::duration<double>(now - last).count();
+        double timeS = std::chrono::duration<double>(now - start).count();
+        last = now;
+
+        for (size_t i = thread; i < bots.size(); i += numThreads)
+            bots[i]->update(dt, timeS);
+    }
+}
+
+static bool run(ThreadPool &pool, const RunConfig &config) {
+    std::vector<Bot *> bots;
+
+    for (size_t i = 0; i < config.numClients; i++) {
+        ENetAddress address;
+        enet_address_set_host(&address, config.host.c_str());
+        address.port = config.port + i % config.numShards;
+
+        bots.push_back(new Bot(i, config.orderRate));
+        if (!bots.back()->connect(address)) {
+            std::cerr << "Failed to create bot host" << std::endl;
+            for (auto bot : bots)
+                delete bot;
+            return false;
+        }
+    }
+
+    size_t numThreads = pool.getNumThreads();
+    Clock::time_point start = Clock::now();
+
+    // Give the matches some time to start and settle
+    Clock::time_point warmUpEnd = start + std::chrono::seconds(2);
+    pool.run(numThreads, [&](size_t thread, size_t) {
+        serviceBots(bots, thread, numThreads, start, warmUpEnd);
+    });
+
+    size_t numStarted = 0;
+    for (auto bot : bots) {
+        numStarted += bot->started;
+        bot->startMeasuring();
+    }
+
+    double cpuStart = cpuTimeS();
+    double serverCpuStart = config.serverPid ? cpuTimeS(config.serverPid) : 0;
+    Clock::time_point measureStart = Clock::now();
+
+    Clock::time_point end = measureStart +
+        std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(config.seconds));
+    pool.run(numThreads, [&](size_t thread, size_t) {
+        serviceBots(bots, thread, numThreads, start, end);
+    });
+
+    double elapsedS = std::chrono::duration<double>(Clock::now() - measureStart).count();
+    double cpuS = cpuTimeS() - cpuStart;
+    double serverCpuS = config.serverPid ? cpuTimeS(config.serverPid) - serverCpuStart : 0;
+
+    size_t ticks = 0, bytes = 0;
+    std::vector<double> latenessMs;
+    for (auto bot : bots) {
+        ticks += bot->ticksMeasured;
+        bytes += bot->host->totalReceivedData - bot->bytesAtStart;
+        bot->getLateness(latenessMs);
+    }
+    std::sort(latenessMs.begin(), latenessMs.end());
+
+    std::cout << config.numClients << " clients, "
+              << config.orderRate << " orders/s: "
+              << numStarted << " started, "
+              << (numStarted > 0 ? ticks / elapsedS / numStarted : 0.0)
+              << " ticks/s, lateness p50 " << percentile(latenessMs, 0.5)
+              << "ms, p90 " << percentile(latenessMs, 0.9)
+              << "ms, p99 " << percentile(latenessMs, 0.99)
+              << "ms, max " << (latenessMs.empty() ? 0.0 : latenessMs.back())
+              << "ms, " << (ticks > 0 ? bytes / ticks : 0) << " bytes/tick, "
+              << "loadtest CPU " << cpuS / elapsedS * 100 << "%";
+    if (config.serverPid)
+        std::cout << ", server CPU " << serverCpuS / elapsedS * 100 << "%";
+    std::cout << std::endl;
+
+    for (auto bot : bots)
+        delete bot;
+
+    return true;
+}
+
+// Parses a comma separated list of numbers
+static std::vector<double> parseList(const std::string &s) {
+    std::vector<double> values;
+    std::istringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, ','))
+        values.push_back(strtod(item.c_str(), NULL));
+    return values;
+}
+
+static void usage() {
+    std::cerr << "Usage: loadtest [--host HOST] [--port N] [--shards N] "
+              << "[--clients N[,N...]] [--order-rate R[,R...]] "
+              << "[--seconds N] [--threads N] [--server-pid PID]" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    RunConfig config;
+    config.host = "127.0.0.1";
+    config.port = 1234;
+    config.numShards = 1;
+    config.seconds = 10;
+    config.serverPid = 0;
+
+    std::vector<double> clientCounts(1, 8);
+    std::vector<double> orderRates(1, 5);
+    size_t numThreads = 0;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        bool haveValue = i + 1 < argc;
+
+        if (arg == "--host" && haveValue)
+            config.host = argv[++i];
+        else if (arg == "--port" && haveValue)
+            config.port = strtoul(argv[++i], NULL, 10);
+        else if (arg == "--shards" && haveValue)
+            config.numShards = strtoul(argv[++i], NULL, 10);
+        else if (arg == "--clients" && haveValue)
+            clientCounts = parseList(argv[++i]);
+        else if (arg == "--order-rate" && haveValue)
+            orderRates = parseList(argv[++i]);
+        else if (arg == "--seconds" && haveValue)
+            config.seconds = strtod(argv[++i], NULL);
+        else if (arg == "--threads" && haveValue)
+            numThreads = strtoul(argv[++i], NULL, 10);
+        else if (arg == "--server-pid" && haveValue)
+            config.serverPid = strtol(argv[++i], NULL, 10);
+        else {
+            usage();
+            return 1;
+        }
+    }
+
+    if (config.numShards == 0 || config.seconds <= 0) {
+        usage();
+        return 1;
+    }
+
+    if (enet_initialize() != 0) {
+        std::cerr << "Failed to initialize ENet" << std::endl;
+        return 1;
+    }
+
+    ThreadPool pool(numThreads);
+
+    for (double numClients : clientCounts) {
+        for (double orderRate : orderRates) {
+            config.numClients = static_cast<size_t>(numClients);
+            config.orderRate = orderRate;
+
+            if (!run(pool, config)) {
+                enet_deinitialize();
+                return 1;
+            }
+        }
+    }
+
+    enet_deinitialize();
+
+    return 0;
+}
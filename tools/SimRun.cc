@@ -0,0 +1,426 @@
+// simrun runs the game simulation without graphics or networking,
+// as fast as possible. It is meant for benchmarking the simulation
+// and checking that it stays deterministic.
+//
+// Usage: simrun [options]
+//   --ticks N           number of ticks to run (default 1000)
+//   --players N         number of players (default 2)
+//   --fleet-size N      number of ships per player (default 1)
+//   --size W H          map size (default 256 256)
+//   --seed N            random seed (default 0)
+//   --orders FILE       execute orders from a script file
+//   --random-orders N   issue N random orders per tick
+//   --record FILE       record the run as a replay
+//   --keyframe-interval N
+//                       store a keyframe every N ticks in the replay
+//                       (default 100)
+//   --replay FILE       run the ticks of a replay instead; the settings
+//                       are taken from the replay
+//   --seek TICK         jump to TICK in the replay before running
+//   --matches N         run N independent matches with the seeds
+//                       seed, seed + 1, ... and report each of them
+//   --threads N         number of worker threads for --matches
+//                       (default: one per hardware thread)
+//
+// Order scripts contain one order per line, in the format
+//   <tick> <player> <forward|backward|left|right> [<first>-<last>]
+// where the optional range selects the player's units by index (default:
+// the first one). Lines starting with '#' are ignored.
+//
+// With more than one ship per player, random orders command a random
+// range of the player's ships.
+
+#include "game/Sim.hh"
+#include "game/ReplayPlayer.hh"
+#include "game/SimBatch.hh"
+#include "common/BitStream.hh"
+#include "common/GameSettings.hh"
+#include "common/Order.hh"
+#include "common/Replay.hh"
+#include "util/Log.hh"
+#include "util/Profiling.hh"
+#include "util/ThreadPool.hh"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+typedef std::map<size_t, std::vector<Order>> OrderScript;
+
+static bool parseDirection(const std::string &s, Direction &direction) {
+    if (s == "forward") direction = DIRECTION_FORWARD;
+    else if (s == "backward") direction = DIRECTION_BACKWARD;
+    else if (s == "left") direction = DIRECTION_LEFT;
+    else if (s == "right") direction = DIRECTION_RIGHT;
+    else return false;
+
+    return true;
+}
+
+static bool loadOrderScript(const std::string &filename, OrderScript &script) {
+    std::ifstream file(filename);
+    if (!file.good()) {
+        std::cerr << "Failed to open order script " << filename << std::endl;
+        return false;
+    }
+
+    std::string line;
+    size_t lineNumber = 0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        std::istringstream ss(line);
+        size_t tick;
+        PlayerId player;
+        std::string direction;
+
+        Order order(Order::ACCELERATE);
+        if (!(ss >> tick >> player >> direction) ||
+            !parseDirection(direction, order.accelerate.direction)) {
+            std::cerr << filename << ":" << lineNumber
+                      << ": invalid order" << std::endl;
+            return false;
+        }
+
+        uint32_t first, last;
+        char dash;
+        if (ss >> first) {
+            if (!(ss >> dash >> last) || dash != '-' || last < first) {
+                std::cerr << filename << ":" << lineNumber
+                          << ": invalid unit range" << std::endl;
+                return false;
+            }
+
+            order.units.addRange(first, last - first + 1);
+        }
+
+        order.player = player;
+        order.seq = lineNumber;
+        order.tick = tick;
+        script[tick].push_back(order);
+    }
+
+    return true;
+}
+
+// Produces the orders of one match, from the script and random orders
+struct OrderGenerator {
+    OrderGenerator(const OrderScript &script, size_t numPlayers,
+                   size_t fleetSize, size_t numRandomOrders, uint32_t seed)
+        : script(script), numPlayers(numPlayers), fleetSize(fleetSize),
+          numRandomOrders(numRandomOrders), random(seed), orderCounter(0) {
+    }
+
+    void generate(size_t tick, std::vector<Order> &orders) {
+        auto scripted = script.find(tick);
+        if (scripted != script.end())
+            orders.insert(orders.end(), scripted->second.begin(),
+                          scripted->second.end());
+
+        for (size_t i = 0; i < numRandomOrders; i++) {
+            Order order(Order::ACCELERATE);
+            order.player = 1 + random() % numPlayers;
+            order.seq = ++orderCounter;
+            order.tick = tick;
+            order.accelerate.direction = static_cast<Direction>(random() % 4);
+
+            if (fleetSize > 1) {
+                uint32_t first = random() % fleetSize;
+                order.units.addRange(first, 1 + random() % (fleetSize - first));
+            }
+
+            orders.push_back(order);
+        }
+    }
+
+private:
+    const OrderScript &script;
+    size_t numPlayers;
+    size_t fleetSize;
+    size_t numRandomOrders;
+    std::mt19937 random;
+    uint32_t orderCounter;
+};
+
+static void usage() {
+    std::cerr << "Usage: simrun [--ticks N] [--players N] [--fleet-size N] "
+              << "[--size W H] "
+              << "[--seed N] [--orders FILE] [--random-orders N] "
+              << "[--record FILE] [--keyframe-interval N] "
+              << "[--replay FILE] [--seek TICK] "
+              << "[--matches N] [--threads N]"
+              << std::endl;
+}
+
+static void printHash(const Sim &sim) {
+    std::cout << "State hash: " << std::hex << std::setw(16)
+              << std::setfill('0') << sim.getState().hash() << std::dec
+              << std::endl;
+}
+
+static int runReplay(const std::string &filename, size_t seekTick,
+                     size_t numTicks, bool haveNumTicks) {
+    ReplayReader reader(filename);
+    if (!reader.isOpen())
+        return 1;
+
+    std::cout << "Replay with " << reader.getNumTicks() << " ticks and "
+              << reader.getSettings().players.size() << " players on a "
+              << reader.getSettings().mapW << "x" << reader.getSettings().mapH
+              << " map" << std::endl;
+
+    ReplayPlayer player(reader);
+
+    if (seekTick > 0) {
+        auto startTime = std::chrono::steady_clock::now();
+
+        if (!player.seek(seekTick)) {
+            std::cerr << "Failed to seek to tick " << seekTick << std::endl;
+            return 1;
+        }
+
+        double elapsedS = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - startTime).count();
+        std::cout << "Seeked to tick " << seekTick << " in " << elapsedS
+                  << "s" << std::endl;
+        printHash(player.getSim());
+    }
+
+    if (!haveNumTicks)
+        numTicks = reader.getNumTicks() - player.getTick();
+
+    ProfilingData::reset();
+
+    auto startTime = std::chrono::steady_clock::now();
+
+    size_t ticksRun = 0;
+    while (ticksRun < numTicks && player.step())
+        ticksRun++;
+
+    double elapsedS = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - startTime).count();
+
+    ProfilingData::dump();
+
+    std::cout << "Ran " << ticksRun << " ticks in " << elapsedS << "s ("
+              << (elapsedS > 0 ? ticksRun / elapsedS : 0) << " ticks/s), "
+              << "now at tick " << player.getTick() << std::endl;
+    printHash(player.getSim());
+
+    return 0;
+}
+
+static int runBatch(const GameSettings &settings, size_t numMatches,
+                    size_t numThreads, size_t numTicks,
+                    const OrderScript &script, size_t numRandomOrders) {
+    std::vector<GameSettings> matchSettings(numMatches, settings);
+    std::vector<OrderGenerator> generators;
+
+    for (size_t i = 0; i < numMatches; i++) {
+        matchSettings[i].randomSeed = settings.randomSeed + i;
+        generators.push_back(OrderGenerator(script, settings.players.size(),
+                                            settings.fleetSize, numRandomOrders,
+                                            matchSettings[i].randomSeed));
+    }
+
+    ThreadPool pool(numThreads);
+
+    std::cout << "Running " << numMatches << " matches of " << numTicks
+              << " ticks with " << settings.players.size()
+              << " players on a " << settings.mapW << "x" << settings.mapH
+              << " map, using " << pool.getNumThreads() << " threads"
+              << std::endl;
+
+    auto startTime = std::chrono::steady_clock::now();
+
+    SimBatch batch(pool, matchSettings,
+        [&] (size_t match, size_t tick, std::vector<Order> &orders) {
+            generators[match].generate(tick, orders);
+        });
+
+    double setupS = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - startTime).count();
+
+    startTime = std::chrono::steady_clock::now();
+
+    batch.run(numTicks);
+
+    double elapsedS = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - startTime).count();
+
+    for (size_t i = 0; i < numMatches; i++) {
+        SimBatch::Result result = batch.getResult(i);
+
+        std::cout << "Match " << i << ": seed " << matchSettings[i].randomSeed
+                  << ", " << (result.simulationS > 0 ?
+                              result.ticks / result.simulationS : 0)
+                  << " ticks/s, state hash " << std::hex << std::setw(16)
+                  << std::setfill('0') << result.hash << std::dec
+                  << std::setfill(' ') << std::endl;
+    }
+
+    size_t totalTicks = numMatches * numTicks;
+    std::cout << "Created matches in " << setupS << "s" << std::endl;
+    std::cout << "Ran " << totalTicks << " ticks in " << elapsedS << "s ("
+              << (elapsedS > 0 ? totalTicks / elapsedS : 0) << " ticks/s)"
+              << std::endl;
+
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    Log::addSink(new ConsoleLogSink);
+
+    size_t numTicks = 1000;
+    bool haveNumTicks = false;
+    size_t numPlayers = 2;
+    size_t numRandomOrders = 0;
+    std::string orderFilename;
+    std::string recordFilename;
+    size_t keyframeInterval = 100;
+    std::string replayFilename;
+    size_t seekTick = 0;
+    size_t numMatches = 0;
+    size_t numThreads = 0;
+
+    GameSettings settings;
+    settings.randomSeed = 0;
+    settings.mapW = 256;
+    settings.mapH = 256;
+    settings.heightLimit = 8;
+    settings.tickLengthMs = 100;
+    settings.fleetSize = 1;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        bool haveValue = i + 1 < argc;
+
+        if (arg == "--ticks" && haveValue) {
+            numTicks = strtoul(argv[++i], NULL, 10);
+            haveNumTicks = true;
+        } else if (arg == "--players" && haveValue)
+            numPlayers = strtoul(argv[++i], NULL, 10);
+        else if (arg == "--fleet-size" && haveValue)
+            settings.fleetSize = strtoul(argv[++i], NULL, 10);
+        else if (arg == "--size" && i + 2 < argc) {
+            settings.mapW = strtoul(argv[++i], NULL, 10);
+            settings.mapH = strtoul(argv[++i], NULL, 10);
+        } else if (arg == "--seed" && haveValue)
+            settings.randomSeed = strtoul(argv[++i], NULL, 10);
+        else if (arg == "--orders" && haveValue)
+            orderFilename = argv[++i];
+        else if (arg == "--random-orders" && haveValue)
+            numRandomOrders = strtoul(argv[++i], NULL, 10);
+        else if (arg == "--record" && haveValue)
+            recordFilename = argv[++i];
+        else if (arg == "--keyframe-interval" && haveValue)
+            keyframeInterval = strtoul(argv[++i], NULL, 10);
+        else if (arg == "--replay" && haveValue)
+            replayFilename = argv[++i];
+        else if (arg == "--seek" && haveValue)
+            seekTick = strtoul(argv[++i], NULL, 10);
+        else if (arg == "--matches" && haveValue)
+            numMatches = strtoul(argv[++i], NULL, 10);
+        else if (arg == "--threads" && haveValue)
+            numThreads = strtoul(argv[++i], NULL, 10);
+        else {
+            usage();
+            return 1;
+        }
+    }
+
+    if (!replayFilename.empty())
+        return runReplay(replayFilename, seekTick, numTicks, haveNumTicks);
+
+    if (numPlayers == 0 || settings.fleetSize == 0 ||
+        settings.mapW == 0 || settings.mapH == 0) {
+        usage();
+        return 1;
+    }
+
+    for (size_t i = 1; i <= numPlayers; i++) {
+        PlayerInfo player;
+        player.id = i;
+        player.name = "bot" + std::to_string(i);
+        player.team = i;
+        player.color = i % 4;
+        settings.players.push_back(player);
+    }
+
+    OrderScript script;
+    if (!orderFilename.empty() && !loadOrderScript(orderFilename, script))
+        return 1;
+
+    if (numMatches > 0)
+        return runBatch(settings, numMatches, numThreads, numTicks,
+                        script, numRandomOrders);
+
+    Sim sim(settings);
+
+    std::unique_ptr<ReplayWriter> replay;
+    if (!recordFilename.empty()) {
+        replay.reset(new ReplayWriter(recordFilename, settings, keyframeInterval));
+        if (!replay->isOpen())
+            return 1;
+    }
+
+    BitStreamWriter keyframe;
+    auto writeKeyframe = [&] (size_t tick) {
+        keyframe.reset();
+        sim.save(keyframe);
+        replay->writeKeyframe(tick, keyframe.ptr(), keyframe.size());
+    };
+
+    if (replay)
+        writeKeyframe(0);
+
+    OrderGenerator generator(script, numPlayers, settings.fleetSize,
+                             numRandomOrders, settings.randomSeed);
+    std::vector<Order> orders;
+
+    std::cout << "Running " << numTicks << " ticks with " << numPlayers
+              << " players on a " << settings.mapW << "x" << settings.mapH
+              << " map" << std::endl;
+
+    ProfilingData::reset();
+
+    auto startTime = std::chrono::steady_clock::now();
+
+    for (size_t tick = 1; tick <= numTicks; tick++) {
+        orders.clear();
+        generator.generate(tick, orders);
+
+        sim.runTick(orders);
+
+        if (replay) {
+            replay->writeTick(tick, orders);
+
+            if (replay->wantsKeyframe(tick))
+                writeKeyframe(tick);
+        }
+    }
+
+    double elapsedS = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - startTime).count();
+
+    ProfilingData::dump();
+
+    std::cout << "Ran " << numTicks << " ticks in " << elapsedS << "s ("
+              << (elapsedS > 0 ? numTicks / elapsedS : 0) << " ticks/s)"
+              << std::endl;
+    printHash(sim);
+
+    return 0;
+}
@@ -1,5 +1,7 @@
 #include "util/Fixed.hh"
 
+#include "common/BitStream.hh"
+
 fixed sqrt(fixed s) {
     if (s == fixed(0))
         return fixed(0);
@@ -101,3 +103,40 @@ std::ostream& operator<<(std::ostream& os, const fvec3& v) {
                           << v.y << ", "
                           << v.z << ")";
 }
+
+void read(BitStreamReader &reader, fixed &f) {
+    int32_t raw;
+    read(reader, raw);
+
+    f = fixed::fromRaw(raw);
+}
+
+void write(BitStreamWriter &writer, fixed f) {
+    write(writer, static_cast<int32_t>(f.toRaw()));
+}
+
+void read(BitStreamReader &reader, fvec3 &v) {
+    read(reader, v.x);
+    read(reader, v.y);
+    read(reader, v.z);
+}
+
+void write(BitStreamWriter &writer, const fvec3 &v) {
+    write(writer, v.x);
+    write(writer, v.y);
+    write(writer, v.z);
+}
+
+void read(BitStreamReader &reader, fquat &q) {
+    read(reader, q.w);
+    read(reader, q.x);
+    read(reader, q.y);
+    read(reader, q.z);
+}
+
+void write(BitStreamWriter &writer, const fquat &q) {
+    write(writer, q.w);
+    write(writer, q.x);
+    write(writer, q.y);
+    write(writer, q.z);
+}
@@ -15,6 +15,9 @@ typedef glm::detail::tquat<fixed, glm::highp> fquat;
 typedef glm::detail::tmat3x3<fixed, glm::highp> fmat3;
 typedef glm::detail::tmat4x4<fixed, glm::highp> fmat4;
 
+struct BitStreamReader;
+struct BitStreamWriter;
+
 fixed sqrt(fixed);
 
 // Below we implement some functions on quaternions and vectors using fixed point math.
@@ -41,4 +44,13 @@ std::ostream& operator<<(std::ostream&, fixed);
 std::ostream& operator<<(std::ostream&, const fvec2 &);
 std::ostream& operator<<(std::ostream&, const fvec3 &);
 
+void read(BitStreamReader &, fixed &);
+void write(BitStreamWriter &, fixed);
+
+void read(BitStreamReader &, fvec3 &);
+void write(BitStreamWriter &, const fvec3 &);
+
+void read(BitStreamReader &, fquat &);
+void write(BitStreamWriter &, const fquat &);
+
 #endif
@@ -2,6 +2,7 @@
 
 #include <iostream>
 #include <ctime>
+#include <mutex>
 
 #ifdef WIN32
 #include <windows.h> // Colored console output
@@ -139,11 +140,17 @@ void FileLogSink::write(LogMessage const& message) {
     fstream.flush();
 }
 
+// Messages may come from worker threads, e.g. in batch simulations
+static std::mutex logMutex;
+
 void Log::addSink(LogSink* sink) {
+    std::lock_guard<std::mutex> lock(logMutex);
     sinks.push_back(std::unique_ptr<LogSink>(sink));
 }
 
 void Log::write(LogMessage const& message) {
+    std::lock_guard<std::mutex> lock(logMutex);
+
     if (severityFilters.find(message.getLogger()) != severityFilters.end() &&
         severityFilters[message.getLogger()] > message.getSeverity())
         return;
@@ -153,6 +160,7 @@ void Log::write(LogMessage const& message) {
 }
 
 void Log::setSeverityFilter(std::string const& logger, LogSeverity severity) {
+    std::lock_guard<std::mutex> lock(logMutex);
     severityFilters[logger] = severity; 
 }
 
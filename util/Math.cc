@@ -69,42 +69,44 @@ bool AABB::intersectWithRay(const Ray &ray, float t0, float t1, float *distance)
     return ((tmin < t1) && (tmax > t0));
 }
 
-float randomFloat() {
-    return static_cast <float>(rand()) / static_cast <float>(RAND_MAX);
-}
-
-PerlinNoise::PerlinNoise(size_t width, size_t height)
+PerlinNoise::PerlinNoise(size_t width, size_t height, const Random &random)
     : width(width)
     , height(height)
-    , whiteNoise(width * height)
+    , random(random)
     , noise(width * height) {
 }
 
 void PerlinNoise::generate(size_t octaves, float persistence) {
-    assert(octaves > 0);
+    generateChunk(0, 0, width, height, octaves, persistence);
+}
 
-    generateWhiteNoise();
+void PerlinNoise::generateChunk(size_t x0, size_t y0, size_t sizeX, size_t sizeY,
+                                size_t octaves, float persistence) {
+    assert(x0 + sizeX <= width);
+    assert(y0 + sizeY <= height);
+
+    for (size_t x = x0; x < x0 + sizeX; x++) {
+        for (size_t y = y0; y < y0 + sizeY; y++) {
+            noise[y*width + x] = sample(x, y, octaves, persistence);
+        }
+    }
+}
+
+float PerlinNoise::sample(size_t x, size_t y, size_t octaves, float persistence) const {
+    assert(octaves > 0);
 
     float amplitude = 1.0f;
     float totalAmplitude = 0.0f; 
+    float value = 0.0f;
 
     for (int octave = octaves - 1; octave >= 0; octave--) {
         amplitude *= persistence;
         totalAmplitude += amplitude;
 
-        for (size_t x = 0; x < width; x++) {
-            for (size_t y = 0; y < height; y++) {
-                noise[y*width + x] += generateSmoothNoise(octave, x, y) * amplitude;
-            }
-        }
+        value += generateSmoothNoise(octave, x, y) * amplitude;
     }
 
-
-    for (size_t x = 0; x < width; x++) {
-        for (size_t y = 0; y < height; y++) {
-            noise[y*width + x] /= totalAmplitude;
-        }
-    }
+    return value / totalAmplitude;
 }
 
 void PerlinNoise::smooth() {
@@ -138,15 +140,11 @@ void PerlinNoise::smooth() {
     noise = newNoise;
 }
 
-void PerlinNoise::generateWhiteNoise() {
-    for (size_t x = 0; x < width; x++) {
-        for (size_t y = 0; y < height; y++) {
-            whiteNoise[y*width + x] = randomFloat();
-        }
-    }
+float PerlinNoise::whiteNoise(size_t x, size_t y) const {
+    return random.floatAt(x, y);
 }
 
-float PerlinNoise::generateSmoothNoise(size_t octave, size_t x, size_t y) {
+float PerlinNoise::generateSmoothNoise(size_t octave, size_t x, size_t y) const {
     size_t samplePeriod = 1 << octave; // 2^octave
     float sampleFrequency = 1.0f / samplePeriod;
 
@@ -160,11 +158,11 @@ float PerlinNoise::generateSmoothNoise(size_t octave, size_t x, size_t y) {
     float horizontalBlend = (x - sample_x0) * sampleFrequency;
     float verticalBlend = (y - sample_y0) * sampleFrequency;
 
-    float top = lerp(whiteNoise[sample_y0*width + sample_x0],
-                     whiteNoise[sample_y0*width + sample_x1],
+    float top = lerp(whiteNoise(sample_x0, sample_y0),
+                     whiteNoise(sample_x1, sample_y0),
                      horizontalBlend);
-    float bottom = lerp(whiteNoise[sample_y1*width + sample_x0],
-                        whiteNoise[sample_y1*width + sample_x1],
+    float bottom = lerp(whiteNoise(sample_x0, sample_y1),
+                        whiteNoise(sample_x1, sample_y1),
                         horizontalBlend);
 
     return lerp(top, bottom, verticalBlend);
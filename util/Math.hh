@@ -1,6 +1,8 @@
 #ifndef STRAT_GAME_MATH_HH
 #define STRAT_GAME_MATH_HH
 
+#include "util/Random.hh"
+
 #include <glm/glm.hpp>
 
 #include <vector>
@@ -14,8 +16,6 @@ T lerp(const T &a, const T &b, const U &t) {
     return (1 - t) * a + t * b;
 }
 
-float randomFloat();
-
 struct Ray {
     glm::vec3 origin, direction;
 
@@ -43,12 +43,19 @@ struct AABB {
     bool intersectWithRay(const Ray &, float t0, float t1, float *distance = NULL) const;
 };
 
+// The white noise is taken from a counter-based generator indexed by the
+// grid position, so any point or chunk can be computed independently.
 struct PerlinNoise {
-    PerlinNoise(size_t width, size_t height);
+    PerlinNoise(size_t width, size_t height, const Random &);
 
     void generate(size_t octaves, float persistence = 0.5f);
+    void generateChunk(size_t x0, size_t y0, size_t sizeX, size_t sizeY,
+                       size_t octaves, float persistence = 0.5f);
     void smooth();
 
+    // Computes a single point without touching the stored noise
+    float sample(size_t x, size_t y, size_t octaves, float persistence) const;
+
     float &get(size_t x, size_t y) {
         return noise[y*width + x];
     }
@@ -61,11 +68,12 @@ private:
     size_t width;
     size_t height;
 
-    std::vector<float> whiteNoise;
+    Random random;
+
     std::vector<float> noise;
 
-    void generateWhiteNoise();
-    float generateSmoothNoise(size_t octave, size_t x, size_t y);
+    float whiteNoise(size_t x, size_t y) const;
+    float generateSmoothNoise(size_t octave, size_t x, size_t y) const;
 };
 
 #endif
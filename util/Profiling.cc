@@ -2,9 +2,18 @@
 
 #include <sstream>
 #include <algorithm>
+#include <chrono>
+#include <cassert>
 
 #include "util/Log.hh"
 
+// Profiling does not depend on GLFW, so that the simulation
+// can be profiled without a window
+static double getTime() {
+    return std::chrono::duration<double>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 ProfilingData::ProfilingData(char const* name)
     : name(name), numCalls(0), time(0), parent(current), isRoot(!current) {
     if (!current)
@@ -54,11 +63,11 @@ void ProfilingData::dump() {
     reset();
 }
 
-std::vector<ProfilingData*> ProfilingData::roots;
-ProfilingData* ProfilingData::current = nullptr;
+thread_local std::vector<ProfilingData*> ProfilingData::roots;
+thread_local ProfilingData* ProfilingData::current = nullptr;
 
 ProfilingImpl::ProfilingImpl(ProfilingData& data)
-    : data(data), startTime(glfwGetTime()) {
+    : data(data), startTime(getTime()) {
     /*if (ProfilingData::current != data.parent)
         WARN(profiling) << "Inconsistent profiling calls: " 
             << data.name << " was called first from "
@@ -82,7 +91,7 @@ ProfilingImpl::ProfilingImpl(ProfilingData& data)
 
 ProfilingImpl::~ProfilingImpl() {
     data.numCalls++;
-    data.time += glfwGetTime() - startTime;
+    data.time += getTime() - startTime;
 
     ProfilingData::current = data.parent;
 }
@@ -1,19 +1,19 @@
 #pragma once
 
-#include <GL/glew.h>
-#include <GLFW/glfw3.h>
-
 #include <vector>
 
 #define USE_PROFILING
 
 #ifdef USE_PROFILING
-#   define PROFILE(name) static ProfilingData _profilingData(#name); \
+#   define PROFILE(name) static thread_local ProfilingData _profilingData(#name); \
         ProfilingImpl _profilingImpl(_profilingData)
 #else
 #   define PROFILE(name) do {} while(0)
 #endif
 
+// Profiling data is kept separately for every thread,
+// so that simulations can be profiled on worker threads.
+// reset() and dump() only affect the calling thread.
 struct ProfilingData {
     char const* const name;
 
@@ -30,11 +30,11 @@ struct ProfilingData {
     static void reset();
     static void dump();
 
-    static std::vector<ProfilingData*> roots;
+    static thread_local std::vector<ProfilingData*> roots;
 
 private:
     friend struct ProfilingImpl;
-    static ProfilingData* current; // the block we are currently in
+    static thread_local ProfilingData* current; // the block we are currently in
 };
 
 // Updates given ProfilingData according to time elapsed
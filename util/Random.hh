@@ -0,0 +1,63 @@
+#ifndef STRAT_UTIL_RANDOM_HH
+#define STRAT_UTIL_RANDOM_HH
+
+#include <cstdint>
+
+// Counter-based random number generator, using the SplitMix64 mixing function.
+//
+// Every value is a pure function of the seed and an index, so the results
+// are the same on every platform, and values can be computed in any order,
+// e.g. in parallel or lazily when a part of the map is needed.
+// The only state is the counter used by next(), which makes the generator
+// cheap to copy and store.
+struct Random {
+    explicit Random(uint64_t seed = 0)
+        : key(mix(seed)), counter(0) {
+    }
+
+    // Sequential interface, advances the counter
+    uint32_t next() {
+        return static_cast<uint32_t>(hash(key, counter++) >> 32);
+    }
+
+    // Value in [0, n)
+    uint32_t nextBelow(uint32_t n) {
+        return static_cast<uint32_t>((static_cast<uint64_t>(next()) * n) >> 32);
+    }
+
+    // Indexed interface, does not depend on the counter
+    uint32_t at(uint64_t x, uint64_t y) const {
+        return static_cast<uint32_t>(hash(hash(key, x), y) >> 32);
+    }
+
+    // Value in [0, 1)
+    float floatAt(uint64_t x, uint64_t y) const {
+        return (at(x, y) >> 8) * (1.0f / (1 << 24));
+    }
+
+    // Independent generator, e.g. for one subsystem
+    Random derive(uint64_t stream) const {
+        Random r;
+        r.key = hash(key ^ 0x5bd1e9955bd1e995ULL, stream);
+        return r;
+    }
+
+    uint64_t getCounter() const { return counter; }
+    void setCounter(uint64_t c) { counter = c; }
+
+    static uint64_t mix(uint64_t z) {
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    static uint64_t hash(uint64_t key, uint64_t index) {
+        return mix(key + (index + 1) * 0x9e3779b97f4a7c15ULL);
+    }
+
+private:
+    uint64_t key;
+    uint64_t counter;
+};
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef STRAT_UTIL_SPSC_QUEUE_HH
+#define STRAT_UTIL_SPSC_QUEUE_HH
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <vector>
+
+// A bounded lock-free queue between exactly one producer thread and one
+// consumer thread.
+//
+// The indices only ever grow; the slot of an index is its value modulo the
+// capacity, which is rounded up to a power of two. Each index is written
+// by one side only, so neither push() nor pop() ever waits.
+template<typename T>
+struct SpscQueue {
+    explicit SpscQueue(size_t minCapacity)
+        : head(0), tail(0) {
+        size_t capacity = 1;
+        while (capacity < minCapacity)
+            capacity *= 2;
+
+        items.resize(capacity);
+        mask = capacity - 1;
+    }
+
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue &operator=(const SpscQueue &) = delete;
+
+    // Called by the producer. Returns false if the queue is full.
+    bool push(const T &item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == items.size())
+            return false;
+
+        items[t & mask] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Called by the consumer. Returns false if the queue is empty.
+    bool pop(T &item) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+            return false;
+
+        item = items[h & mask];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::vector<T> items;
+    size_t mask;
+
+    // Next item to pop, written by the consumer. The indices are kept on
+    // separate cache lines so that the two threads do not contend for them.
+    alignas(64) std::atomic<size_t> head;
+
+    // Next slot to push to, written by the producer
+    alignas(64) std::atomic<size_t> tail;
+};
+
+#endif
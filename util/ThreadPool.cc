@@ -0,0 +1,74 @@
+#include "util/ThreadPool.hh"
+
+#include <cassert>
+
+ThreadPool::ThreadPool(size_t numThreads)
+    : task(nullptr),
+      numTasks(0),
+      nextTask(0),
+      tasksDone(0),
+      batch(0),
+      quit(false) {
+    if (numThreads == 0)
+        numThreads = std::thread::hardware_concurrency();
+    if (numThreads == 0)
+        numThreads = 1;
+
+    for (size_t i = 0; i < numThreads; i++)
+        threads.push_back(std::thread(&ThreadPool::work, this, i));
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    wakeUp.notify_all();
+
+    for (auto &thread : threads)
+        thread.join();
+}
+
+void ThreadPool::run(size_t numTasks, const Task &task) {
+    if (numTasks == 0)
+        return;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    assert(this->task == nullptr); // run() is not reentrant
+
+    this->task = &task;
+    this->numTasks = numTasks;
+    nextTask = 0;
+    tasksDone = 0;
+    batch++;
+
+    wakeUp.notify_all();
+    done.wait(lock, [&] { return tasksDone == numTasks; });
+
+    this->task = nullptr;
+}
+
+void ThreadPool::work(size_t thread) {
+    size_t lastBatch = 0;
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    for (;;) {
+        wakeUp.wait(lock, [&] { return quit || batch != lastBatch; });
+        if (quit)
+            return;
+
+        lastBatch = batch;
+
+        while (nextTask < numTasks) {
+            size_t index = nextTask++;
+
+            lock.unlock();
+            (*task)(index, thread);
+            lock.lock();
+
+            if (++tasksDone == numTasks)
+                done.notify_one();
+        }
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef STRAT_UTIL_THREAD_POOL_HH
+#define STRAT_UTIL_THREAD_POOL_HH
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads that execute batches of tasks.
+//
+// run() hands out the task indices [0, numTasks) to the workers and
+// returns once all of them are done. Workers are identified by an index
+// in [0, getNumThreads()), which can be used to look up per-thread data
+// without any locking.
+struct ThreadPool {
+    typedef std::function<void(size_t task, size_t thread)> Task;
+
+    // Zero threads means one per hardware thread
+    explicit ThreadPool(size_t numThreads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    size_t getNumThreads() const { return threads.size(); }
+
+    void run(size_t numTasks, const Task &);
+
+private:
+    std::vector<std::thread> threads;
+
+    std::mutex mutex;
+    std::condition_variable wakeUp;
+    std::condition_variable done;
+
+    // State of the current batch, protected by mutex
+    const Task *task;
+    size_t numTasks;
+    size_t nextTask;
+    size_t tasksDone;
+    size_t batch;
+    bool quit;
+
+    void work(size_t thread);
+};
+
+#endif